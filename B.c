@@ -0,0 +1,219 @@
+/* MIT License */
+
+/* Copyright (c) 2021 Luís M. S. Russo */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+
+
+/* Benchmark harness. Generates workloads with G and runs the engines. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <assert.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "commands.h"
+
+struct workload{
+  const char *name;
+  const char *args; /* Arguments for G */
+};
+
+static struct workload workloads[] = {
+  {"random", "-s rand"},
+  {"increasing", "-s inc"},
+  {"decreasing", "-s dec"},
+  {"sawtooth", "-s saw"},
+  {"few-open", "-o 16"},
+  {"many-open", "-o 100000000"},
+  {"fifo-close", "-o 10000 -c fifo"},
+  {"random-close", "-o 10000 -c random"},
+  {"lifo-close", "-o 10000 -c lifo"},
+  {"window-close", "-o 100000 -c window -w 10000"},
+};
+
+static long long
+countCommands(const char *file
+              )
+{ /* Counts the commands in a binary file, a batch is one command */
+  int fd = open(file, O_RDONLY);
+  assert(0 <= fd && "Failed open.");
+  int B[BUFSIZ/4];
+  long long skip = 1; /* Skip the header */
+  int size = 0; /* The next integer is a batch size */
+  long long r = 0;
+  ssize_t n;
+
+  while(0 < (n = read(fd, B, sizeof(B)))){
+    assert(0 == n % 4 && "Broken integer read.");
+    for(int i = 0; i < n/4; i++){
+      if(size){ /* Then its marks */
+        size = 0;
+        skip = B[i];
+      } else if(0 < skip)
+        skip--;
+      else {
+        r++;
+        switch(B[i]){ /* The arguments */
+        case mark:
+          break;
+        case rangeQ: case topkQ:
+          skip = 2;
+          break;
+        case batchQ:
+          size = 1;
+          break;
+        default:
+          skip = 1;
+          break;
+        }
+      }
+    }
+  }
+  close(fd);
+
+  return r;
+}
+
+static void
+statValue(const char *out,
+          const char *key,
+          char *r /* At least 32 chars */
+          )
+{ /* Copies the value after key in the statistics of an engine */
+  const char *p = strstr(out, key);
+
+  if(NULL != p){
+    p += strlen(key);
+    snprintf(r, 32, "%.*s", (int)strcspn(p, "\n"), p);
+  }
+}
+
+static void
+run(const char *engine,
+    const char *file,
+    long long cmds
+    )
+{ /* Runs engine over file and prints one line of results */
+  int err[2];
+  int p = pipe(err);
+  assert(0 == p && "Failed pipe.");
+  (void)p;
+
+  struct timespec s, e;
+  clock_gettime(CLOCK_MONOTONIC, &s);
+
+  pid_t pid = fork();
+  assert(0 <= pid && "Failed fork.");
+  if(0 == pid){ /* Child */
+    char path[256];
+    snprintf(path, sizeof(path), "./%s", engine);
+    dup2(open(file, O_RDONLY), 0);
+    dup2(open("/dev/null", O_WRONLY), 1);
+    dup2(err[1], 2);
+    close(err[0]);
+    execl(path, path, "-s", (char *)NULL);
+    _exit(127);
+  }
+  close(err[1]);
+
+  char out[2048]; /* Statistics of the engine */
+  int l = 0;
+  ssize_t n;
+  while(0 < (n = read(err[0], out + l, sizeof(out) - 1 - l)))
+    l += n;
+  out[l] = '\0';
+  close(err[0]);
+
+  int status;
+  struct rusage ru;
+  wait4(pid, &status, 0, &ru);
+  clock_gettime(CLOCK_MONOTONIC, &e);
+
+  double ns = (e.tv_sec - s.tv_sec)*1e9 + (e.tv_nsec - s.tv_nsec);
+  char rb[32] = "-"; /* Rebuilds */
+  char bm[32] = "-"; /* Bits per open mark */
+  char tlb[32] = "-"; /* Data TLB misses */
+  statValue(out, "rebuilds ", rb);
+  statValue(out, "peak bits per peak open mark ", bm);
+  statValue(out, "dTLB misses ", tlb);
+
+  printf("%-8s %10.1f %8.1f %10.2f %10ld %9s %10s %12s",
+         engine, ns/1e6, ns/cmds, cmds/(ns/1e3), ru.ru_maxrss, rb, bm, tlb);
+  if(!WIFEXITED(status) || 0 != WEXITSTATUS(status))
+    printf("  FAILED");
+  printf("\n");
+}
+
+int
+main(int argc, char **argv)
+{
+  long long n = 1000000; /* Values per workload */
+  char *engines[] = {"V", "T2", "N"};
+  char **E = engines;
+  int ne = sizeof(engines)/sizeof(char *);
+  int opt;
+
+  while(-1 != (opt = getopt(argc, argv, "n:"))){
+    switch(opt){
+    case 'n':
+      n = atoll(optarg);
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-n values] [engine ...]\n", argv[0]);
+      return 1;
+    }
+  }
+  if(optind < argc){ /* Engines given */
+    E = argv + optind;
+    ne = argc - optind;
+  }
+
+  char file[] = "/tmp/benchXXXXXX";
+  int fd = mkstemp(file);
+  assert(0 <= fd && "Failed temporary file.");
+  close(fd);
+
+  printf("%-8s %10s %8s %10s %10s %9s %10s %12s\n",
+         "engine", "ms", "ns/cmd", "Mcmd/s", "RSS(KB)", "rebuilds", "bits/mark",
+         "dTLB miss");
+  for(size_t w = 0; w < sizeof(workloads)/sizeof(struct workload); w++){
+    char cmd[512];
+    snprintf(cmd, sizeof(cmd), "./G -n %lld %s > %s",
+             n, workloads[w].args, file);
+    int g = system(cmd);
+    assert(0 == g && "Failed generator.");
+    (void)g;
+
+    long long cmds = countCommands(file);
+    printf("# %s: %s, %lld commands\n", workloads[w].name,
+           workloads[w].args, cmds);
+    for(int i = 0; i < ne; i++)
+      run(E[i], file, cmds);
+  }
+
+  unlink(file);
+
+  return 0;
+}
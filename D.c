@@ -0,0 +1,446 @@
+/* MIT License */
+
+/* Copyright (c) 2021 Luís M. S. Russo */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+
+
+/* Differential check of the engines against a simple oracle. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <assert.h>
+#include <sys/wait.h>
+
+#include "commands.h"
+
+#define BLOCK 1024 /* Values per block of the oracle */
+
+static const char *workloads[] = { /* Arguments for G */
+  "-s rand -o 4 -c random -x 50",
+  "-s rand -o 64 -c lifo -q 100",
+  "-s inc -o 100000 -c window -w 5000",
+  "-s dec -o 1000 -c random",
+  "-s saw -p 13 -r 3 -o 300 -x 40",
+  "-d geometric -r 50 -m 90 -q 100 -o 2000 -c random",
+  "-d normal -r 20 -m 10 -o 16 -c fifo",
+  "-s saw -p 13 -r 3 -o 10000 -c random -b 2 -k 100",
+};
+
+static const char *topkWorkloads[] = { /* Also with top k queries */
+  "-s rand -o 8 -c random -x 50 -t 20 -T 4",
+  "-s saw -p 13 -r 3 -o 300 -c lifo -t 10 -T 16",
+  "-s inc -o 10000 -c window -w 500 -t 5",
+  "-d geometric -r 50 -m 90 -o 2000 -c random -t 10 -T 3",
+  "-s dec -o 64 -c fifo -t 20 -T 1",
+};
+
+static const char *rangeWorkloads[] = { /* Also with range queries */
+  "-s rand -o 8 -c random -x 50 -g 50",
+  "-s saw -p 13 -r 3 -o 300 -c lifo -g 100",
+  "-s inc -o 100000 -c window -w 5000 -g 25",
+  "-d geometric -r 50 -m 90 -o 2000 -c random -g 100",
+};
+
+struct answer{
+  int i; /* Queried position */
+  int pos; /* Last position, or end of the range */
+  int v; /* Minimum */
+};
+
+static int
+blockMin(int *A,
+         int *M, /* Block minima */
+         int j, /* First position */
+         int lst /* Past the last position */
+         )
+{ /* Scans the partial blocks and uses M for the full ones */
+  int v = A[j];
+
+  while(j < lst && 0 != j % BLOCK){
+    if(A[j] < v)
+      v = A[j];
+    j++;
+  }
+  while(j + BLOCK <= lst){
+    if(M[j/BLOCK] < v)
+      v = M[j/BLOCK];
+    j += BLOCK;
+  }
+  while(j < lst){
+    if(A[j] < v)
+      v = A[j];
+    j++;
+  }
+
+  return v;
+}
+
+static int
+blockTopk(int *A,
+          int *M, /* Block minima */
+          int j, /* First position */
+          int lst, /* Past the last position */
+          int k,
+          int *K /* The smallest values, increasing */
+          )
+{ /* Skips the blocks that can not change K, returns the values in K */
+  int n = 0;
+
+  while(j < lst){
+    if(0 == j % BLOCK && j + BLOCK <= lst && n == k && K[k-1] <= M[j/BLOCK]){
+      j += BLOCK;
+      continue;
+    }
+    if(n < k || A[j] < K[k-1]){
+      int i = n < k ? n++ : k-1; /* Drops the largest */
+      while(0 < i && A[j] < K[i-1]){
+        K[i] = K[i-1];
+        i--;
+      }
+      K[i] = A[j];
+    }
+    j++;
+  }
+
+  return n;
+}
+
+static int
+readInt(FILE *f
+        )
+{ /* Next argument of the command file, a short file fails the check */
+  int x;
+
+  if(1 != fread(&x, 4, 1, f)){
+    fprintf(stderr, "Truncated command file.\n");
+    exit(1);
+  }
+
+  return x;
+}
+
+static struct answer *
+oracle(const char *file,
+       long long *na, /* Number of answers */
+       int **PA, /* When not NULL, gets the values instead of freeing them */
+       int **PM, /* and their block minima */
+       int *pn /* and their number */
+       )
+{ /* Answers with the minimum of every block and of the partial blocks */
+  FILE *f = fopen(file, "r");
+  assert(NULL != f && "Failed open.");
+
+  int a = BLOCK; /* Alloced values */
+  int n = 0;
+  int *A = malloc(a*sizeof(int));
+  int *M = malloc(a/BLOCK*sizeof(int)); /* Block minima */
+  long long ra = 1024; /* Alloced answers */
+  struct answer *R = malloc(ra*sizeof(struct answer));
+  int c, x;
+  int k = 1; /* Queries in the command */
+  int ka = 0; /* Alloced top k values */
+  int *K = NULL; /* Top k values */
+
+  *na = 0;
+  readInt(f); /* The header is not needed */
+  while(1 == fread(&c, 4, 1, f)){
+    if(mark == c)
+      continue;
+    if(batchQ == c)
+      k = readInt(f);
+
+    for(; 0 < k; k--){
+      x = readInt(f);
+      int lst = n; /* Last position of the range */
+      if(rangeQ == c){
+        lst = readInt(f);
+        if(lst < x){
+          int t = x;
+          x = lst;
+          lst = t;
+        }
+      }
+
+      if(value == c){
+        if(n == a){
+          a *= 2;
+          A = realloc(A, a*sizeof(int));
+          M = realloc(M, a/BLOCK*sizeof(int));
+        }
+        if(0 == n % BLOCK || x < M[n/BLOCK])
+          M[n/BLOCK] = x;
+        A[n++] = x;
+        continue;
+      }
+
+      if(topkQ == c){ /* One answer per value */
+        int t = readInt(f);
+        if(ka < t){
+          ka = t;
+          K = realloc(K, ka*sizeof(int));
+        }
+        t = blockTopk(A, M, x - 1, n, t, K);
+        while(ra < *na + t){
+          ra *= 2;
+          R = realloc(R, ra*sizeof(struct answer));
+        }
+        for(int j = 0; j < t; j++){
+          R[*na].i = x;
+          R[*na].pos = n - 1;
+          R[*na].v = K[j];
+          (*na)++;
+        }
+        continue;
+      }
+
+      /* Query, close, range or batch */
+      if(*na == ra){
+        ra *= 2;
+        R = realloc(R, ra*sizeof(struct answer));
+      }
+      R[*na].i = x;
+      R[*na].pos = rangeQ == c ? lst : n - 1;
+      R[*na].v = blockMin(A, M, x - 1, lst);
+      (*na)++;
+    }
+    k = 1;
+  }
+
+  fclose(f);
+  if(NULL != PA){
+    *PA = A;
+    *PM = M;
+    *pn = n;
+  } else {
+    free(A);
+    free(M);
+  }
+  free(K);
+
+  return R;
+}
+
+static struct answer *
+staticQueries(int *A,
+              int *M, /* Block minima */
+              int n, /* Number of values */
+              const char *file, /* Gets the queries */
+              long long nq /* Number of queries */
+              )
+{ /* Writes random pairs of positions for S and returns their answers */
+  FILE *f = fopen(file, "w");
+  assert(NULL != f && "Failed open.");
+  struct answer *R = malloc(nq*sizeof(struct answer));
+  assert(NULL != R && "Failed alloc.");
+  int q[2];
+
+  for(long long k = 0; k < nq; k++){
+    q[0] = rand() % n;
+    q[1] = rand() % n;
+    if(1 != fwrite(q, sizeof(q), 1, f)){
+      fprintf(stderr, "Failed query write.\n");
+      exit(1);
+    }
+    R[k].i = q[0] < q[1] ? q[0] : q[1];
+    R[k].pos = q[0] < q[1] ? q[1] : q[0];
+    R[k].v = blockMin(A, M, R[k].i, R[k].pos + 1);
+  }
+  fclose(f);
+
+  return R;
+}
+
+static int
+compare(const char *engine,
+        const char *file,
+        const char *out,
+        struct answer *R,
+        long long na
+        )
+{ /* Runs engine over file and compares with the answers R */
+  pid_t pid = fork();
+  assert(0 <= pid && "Failed fork.");
+  if(0 == pid){ /* Child, the engine may carry options as in "V -r" */
+    char path[256];
+    char *A[16];
+    int n = 0;
+    snprintf(path, sizeof(path), "./%s", engine);
+    for(char *w = strtok(path, " "); NULL != w && n < 15; w = strtok(NULL, " "))
+      A[n++] = w;
+    A[n] = NULL;
+    dup2(open(file, O_RDONLY), 0);
+    dup2(open(out, O_WRONLY | O_TRUNC), 1);
+    execv(A[0], A);
+    _exit(127);
+  }
+
+  int status;
+  waitpid(pid, &status, 0);
+  if(!WIFEXITED(status) || 0 != WEXITSTATUS(status)){
+    printf("%-8s FAILED, exit status %d\n", engine, status);
+    return 1;
+  }
+
+  FILE *f = fopen(out, "r");
+  struct answer a;
+  long long k = 0;
+  while(3 == fscanf(f, "%d %d %d", &a.i, &a.pos, &a.v)){
+    if(k == na || a.i != R[k].i || a.pos != R[k].pos || a.v != R[k].v){
+      printf("%-8s MISMATCH at answer %lld: got %d %d %d", engine, k+1,
+             a.i, a.pos, a.v);
+      if(k < na)
+        printf(", expected %d %d %d", R[k].i, R[k].pos, R[k].v);
+      printf("\n");
+      fclose(f);
+      return 1;
+    }
+    k++;
+  }
+  fclose(f);
+
+  if(k != na){
+    printf("%-8s MISSING answers, got %lld of %lld\n", engine, k, na);
+    return 1;
+  }
+
+  printf("%-8s ok\n", engine);
+  return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+  long long n = 1000000; /* Values per workload */
+  int seeds = 2;
+  int ranges = 0; /* Engines answer range queries */
+  int tops = 0; /* Engines answer top k queries */
+  int statics = 0; /* Check the static index of S instead */
+  char *engines[] = {"V", "T2"};
+  char **E = engines;
+  int ne = sizeof(engines)/sizeof(char *);
+  int fails = 0;
+  int opt;
+
+  while(-1 != (opt = getopt(argc, argv, "n:s:rtx"))){
+    switch(opt){
+    case 'n':
+      n = atoll(optarg);
+      break;
+    case 's':
+      seeds = atoi(optarg);
+      break;
+    case 'r':
+      ranges = 1;
+      break;
+    case 't':
+      tops = 1;
+      break;
+    case 'x':
+      statics = 1;
+      break;
+    default:
+      fprintf(stderr,
+              "Usage: %s [-n values] [-s seeds] [-r] [-t] [-x] [engine ...]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+  if(optind < argc){ /* Engines given */
+    E = argv + optind;
+    ne = argc - optind;
+  }
+
+  char file[] = "/tmp/diffXXXXXX";
+  char out[] = "/tmp/diffoutXXXXXX";
+  char idx[] = "/tmp/diffidxXXXXXX"; /* Index of S */
+  char qry[] = "/tmp/diffqryXXXXXX"; /* Queries for S */
+  close(mkstemp(file));
+  close(mkstemp(out));
+  if(statics){
+    close(mkstemp(idx));
+    close(mkstemp(qry));
+  }
+
+  const char **W = workloads;
+  size_t nw = sizeof(workloads)/sizeof(char *);
+  if(ranges){
+    W = rangeWorkloads;
+    nw = sizeof(rangeWorkloads)/sizeof(char *);
+  } else if(tops){
+    W = topkWorkloads;
+    nw = sizeof(topkWorkloads)/sizeof(char *);
+  }
+
+  for(int s = 1; s <= seeds; s++){
+    for(size_t w = 0; w < nw; w++){
+      char cmd[512];
+      snprintf(cmd, sizeof(cmd), "./G -n %lld -S %d %s > %s",
+               n, s, W[w], file);
+      if(0 != system(cmd)){
+        printf("# %s -S %d, FAILED generator\n", W[w], s);
+        fails++;
+        continue;
+      }
+
+      long long na;
+      if(statics){ /* Index the values and query them at random */
+        int *A, *M, nv;
+        free(oracle(file, &na, &A, &M, &nv));
+        snprintf(cmd, sizeof(cmd), "./S -b %s < %s", idx, file);
+        if(0 == nv || 0 != system(cmd)){
+          printf("# %s -S %d, FAILED index\n", W[w], s);
+          fails++;
+        } else {
+          srand(s);
+          struct answer *R = staticQueries(A, M, nv, qry, n);
+          printf("# %s -S %d, %lld queries\n", W[w], s, n);
+          snprintf(cmd, sizeof(cmd), "S %s", idx);
+          fails += compare(cmd, qry, out, R, n);
+          free(R);
+        }
+        free(A);
+        free(M);
+        continue;
+      }
+
+      struct answer *R = oracle(file, &na, NULL, NULL, NULL);
+      printf("# %s -S %d, %lld answers\n", W[w], s, na);
+      if(0 == na){ /* Nothing would be checked */
+        printf("# no answers, FAILED workload\n");
+        fails++;
+      }
+      for(int i = 0; i < ne; i++)
+        fails += compare(E[i], file, out, R, na);
+      free(R);
+    }
+  }
+
+  unlink(file);
+  unlink(out);
+  if(statics){
+    unlink(idx);
+    unlink(qry);
+  }
+
+  return 0 == fails ? 0 : 1;
+}
@@ -0,0 +1,128 @@
+/* MIT License */
+
+/* Copyright (c) 2021 Luís M. S. Russo */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+
+
+/* Runs the fixed capacity engine of fixed.h over a binary command file. */
+
+/* The capacity is set when compiling, -DFCAP=marks, the header of the */
+/* file is not used. */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <limits.h>
+#include <assert.h>
+#include "commands.h"
+#include "fixed.h"
+
+#define sureInline(X) __inline X __attribute__((__gnu_inline__, __always_inline__, __artificial__))
+
+#if !defined(FCAP)
+#define FCAP (1 << 17) /* Open marks */
+#endif
+
+FIXED_RMQ(rmq, FCAP, int, INT_MIN)
+
+volatile int vout;
+
+char buffer[BUFSIZ];
+int *iBuffer;
+int load = 0; /* Current buffer load for Consumer */
+int bufferIdx = 0;
+
+static struct rmq F; /* No allocation */
+
+/* The main thread actually is the consumer */
+static sureInline(int) getInt(void)
+{
+  if(0 == load){
+    int rSize = read(0, &(buffer[0]), BUFSIZ);
+    assert(0 == (rSize % 4) && "Broken integer read.");
+    load = rSize;
+
+    iBuffer = (int*)&(buffer[0]);
+    bufferIdx = 0;
+    if(0 == load) /* Prepare end of file */
+      iBuffer[bufferIdx] = EOF;
+  }
+
+  load -= 4;
+  return iBuffer[bufferIdx++];
+}
+
+int
+main(int argc, char** argv){
+
+  int c; /* Character being read. */
+  int qi; /* Query index. */
+  int k; /* Queries left in a batch */
+
+  rmqInit(&F);
+  getInt(); /* The number of marks is not needed */
+
+  c = getInt();
+  while(0 <= load){ /* There is file to read */
+    switch(c){
+    case value:
+      rmqValue(&F, getInt());
+      break;
+
+    case mark:
+      if(0 > rmqMark(&F)){
+        fprintf(stderr, "More than %d open marks, raise FCAP.\n", FCAP);
+        return 1;
+      }
+      break;
+
+    case query: case closeQ: /* Queries */
+      qi = getInt();
+      if(closeQ == c)
+        vout = rmqClose(&F, qi);
+      else
+        vout = rmqQuery(&F, qi);
+
+      printf("%d ", qi);
+      printf("%d ", F.pos-2);
+      printf("%d\n", vout);
+      break;
+    case rangeQ: case topkQ:
+      getInt();
+      getInt();
+      fprintf(stderr, "Range and top k queries are not supported.\n");
+      return 1;
+    case batchQ: /* Several queries */
+      for(k = getInt(); 0 < k; k--){
+        qi = getInt();
+        vout = rmqQuery(&F, qi);
+
+        printf("%d ", qi);
+        printf("%d ", F.pos-2);
+        printf("%d\n", vout);
+      }
+      break;
+    default:
+      break;
+    }
+    c = getInt();
+  }
+
+  return 0;
+}
@@ -0,0 +1,433 @@
+/* MIT License */
+
+/* Copyright (c) 2021 Luís M. S. Russo */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+
+
+/* Generates workloads directly in the binary command format. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "commands.h"
+
+#define GBUF (1 << 16) /* Integers per write */
+
+int iBuffer[GBUF];
+int load = 0;
+int silent = 0; /* Counting pass, nothing is written */
+
+static void pushInt(int w)
+{
+  ssize_t wriRet;
+
+  if(silent)
+    return;
+
+  if(GBUF == load){
+    wriRet = write(1, iBuffer, sizeof(iBuffer));
+    assert(sizeof(iBuffer) == wriRet && "Broken integer write.");
+    load = 0;
+  }
+
+  iBuffer[load++] = w;
+}
+
+static void flushInts(void)
+{
+  ssize_t wriRet;
+
+  wriRet = write(1, iBuffer, 4*load);
+  assert(4*load == wriRet && "Broken integer write.");
+  load = 0;
+}
+
+static unsigned long long seed;
+
+static unsigned int
+rnd(void)
+{ /* xorshift64*, same stream on every platform */
+  seed ^= seed >> 12;
+  seed ^= seed << 25;
+  seed ^= seed >> 27;
+
+  return (seed * 2685821657736338717ULL) >> 32;
+}
+
+static int
+chance(int p /* Percentage, may exceed 100 */
+       )
+{ /* Number of events for an average of p per 100 */
+  int r = p / 100;
+
+  if((int)(rnd() % 100) < p % 100)
+    r++;
+
+  return r;
+}
+
+enum shapes {
+  randomS,
+  increasing,
+  decreasing,
+  sawtooth
+};
+
+enum distributions {
+  uniform,
+  normal,
+  geometric
+};
+
+enum orders {
+  fifo,
+  lifo,
+  randomO,
+  window
+};
+
+struct workload{
+  long long n; /* Number of values */
+  int shape; /* How values evolve */
+  int dist; /* Distribution of the random part of values */
+  int range; /* Values, or noise, are below range */
+  int period; /* Sawtooth period */
+  int markP; /* Percentage of values that get marked */
+  int queryP; /* Queries per 100 values */
+  int rangeP; /* Range queries per 100 values */
+  int batchP; /* Batch queries per 100 values */
+  int batchK; /* Marks per batch query */
+  int topP; /* Top k queries per 100 values */
+  int topK; /* Values per top k query */
+  int closeP; /* Closes per 100 values */
+  int open; /* Maximum number of simultaneously open marks */
+  int order; /* Which mark is closed */
+  int win; /* Marks older than this are closed, for window */
+  unsigned long long seed;
+};
+
+static int
+noise(struct workload *W
+      )
+{
+  unsigned int r;
+
+  switch(W->dist){
+  case normal: /* Sum of four uniforms */
+    r = rnd() % W->range + rnd() % W->range + rnd() % W->range
+      + rnd() % W->range;
+    return r / 4;
+  case geometric: /* Halves for every unit over range/32 */
+    r = rnd();
+    r = (0 == r ? 32 : __builtin_ctz(r)) * (W->range / 32 + 1)
+      + rnd() % (W->range / 32 + 1);
+    return r < (unsigned int)W->range ? (int)r : W->range - 1;
+  default:
+    return rnd() % W->range;
+  }
+}
+
+static int
+nextValue(struct workload *W,
+          long long i /* Position of the value */
+          )
+{
+  int x = noise(W);
+
+  switch(W->shape){
+  case increasing:
+    return (int)(i % (INT_MAX/2)) + x;
+  case decreasing:
+    return INT_MAX/2 - (int)(i % (INT_MAX/2)) + x;
+  case sawtooth:
+    return (int)(i % W->period) * W->range + x;
+  default:
+    return x;
+  }
+}
+
+struct ring{ /* Open marks, oldest at head */
+  int *O;
+  int a; /* Alloced positions */
+  int head;
+  int cnt;
+};
+
+static int
+closeOne(struct workload *W,
+         struct ring *R
+         )
+{ /* Removes an open mark, chosen by the close order */
+  int k = 0; /* Offset from head */
+
+  if(lifo == W->order)
+    k = R->cnt - 1;
+  else if(randomO == W->order)
+    k = rnd() % R->cnt;
+
+  k = (R->head + k) % R->a;
+  int m = R->O[k];
+  if(lifo == W->order){
+    R->cnt--;
+    return m;
+  }
+
+  R->O[k] = R->O[R->head];
+  R->head = (R->head + 1) % R->a;
+  R->cnt--;
+
+  return m;
+}
+
+static long long
+generate(struct workload *W
+         )
+{ /* Returns the number of marks */
+  struct ring R;
+  long long q = 0;
+  long long i;
+  int t;
+  int k;
+
+  R.a = W->open;
+  R.O = malloc(R.a*sizeof(int));
+  assert(NULL != R.O && "Failed alloc.");
+  R.head = 0;
+  R.cnt = 0;
+
+  seed = W->seed;
+  for(i = 1; i <= W->n; i++){
+    pushInt(value);
+    pushInt(nextValue(W, i));
+
+    if((int)(rnd() % 100) < W->markP){
+      if(R.cnt == R.a){ /* Make room */
+        pushInt(closeQ);
+        pushInt(closeOne(W, &R));
+      }
+      pushInt(mark);
+      R.O[(R.head + R.cnt) % R.a] = (int)i;
+      R.cnt++;
+      q++;
+    }
+
+    for(t = chance(W->queryP); 0 < R.cnt && 0 < t; t--){
+      pushInt(query);
+      pushInt(R.O[(R.head + rnd() % R.cnt) % R.a]);
+    }
+
+    for(t = chance(W->rangeP); 0 < R.cnt && 0 < t; t--){
+      pushInt(rangeQ);
+      pushInt(R.O[(R.head + rnd() % R.cnt) % R.a]);
+      pushInt(R.O[(R.head + rnd() % R.cnt) % R.a]);
+    }
+
+    for(t = chance(W->batchP); 0 < R.cnt && 0 < t; t--){
+      pushInt(batchQ);
+      pushInt(W->batchK);
+      for(k = 0; k < W->batchK; k++)
+        pushInt(R.O[(R.head + rnd() % R.cnt) % R.a]);
+    }
+
+    for(t = chance(W->topP); 0 < R.cnt && 0 < t; t--){
+      pushInt(topkQ);
+      pushInt(R.O[(R.head + rnd() % R.cnt) % R.a]);
+      pushInt(W->topK);
+    }
+
+    if(window == W->order){
+      while(0 < R.cnt && R.O[R.head] + W->win <= i){
+        pushInt(closeQ);
+        pushInt(closeOne(W, &R));
+      }
+    } else {
+      for(t = chance(W->closeP); 0 < R.cnt && 0 < t; t--){
+        pushInt(closeQ);
+        pushInt(closeOne(W, &R));
+      }
+    }
+  }
+
+  free(R.O);
+  return q;
+}
+
+static void
+usage(char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [options] > file\n"
+          "  -n values     number of values (1000000)\n"
+          "  -s shape      rand, inc, dec or saw (rand)\n"
+          "  -d dist       uniform, normal or geometric (uniform)\n"
+          "  -r range      random part of values is below range (1000000)\n"
+          "  -p period     sawtooth period (1000)\n"
+          "  -m percent    values followed by a mark (50)\n"
+          "  -q percent    queries per 100 values (25)\n"
+          "  -g percent    range queries per 100 values (0)\n"
+          "  -b percent    batch queries per 100 values (0)\n"
+          "  -k marks      marks per batch query (64)\n"
+          "  -t percent    top k queries per 100 values (0)\n"
+          "  -T k          values per top k query (8)\n"
+          "  -x percent    closes per 100 values (0)\n"
+          "  -o marks      maximum open marks, the oldest is closed (1000)\n"
+          "  -c order      fifo, lifo, random or window (fifo)\n"
+          "  -w values     marks older than this are closed, for window (1000)\n"
+          "  -S seed       random seed (1)\n",
+          name);
+}
+
+int
+main(int argc, char **argv)
+{
+  struct workload W;
+  int opt;
+
+  W.n = 1000000;
+  W.shape = randomS;
+  W.dist = uniform;
+  W.range = 1000000;
+  W.period = 1000;
+  W.markP = 50;
+  W.queryP = 25;
+  W.rangeP = 0;
+  W.batchP = 0;
+  W.batchK = 64;
+  W.topP = 0;
+  W.topK = 8;
+  W.closeP = 0;
+  W.open = 1000;
+  W.order = fifo;
+  W.win = 1000;
+  W.seed = 1;
+
+  while(-1 != (opt = getopt(argc, argv, "n:s:d:r:p:m:q:g:b:k:t:T:x:o:c:w:S:"))){
+    switch(opt){
+    case 'n':
+      W.n = atoll(optarg);
+      break;
+    case 's':
+      if(0 == strcmp("inc", optarg))
+        W.shape = increasing;
+      else if(0 == strcmp("dec", optarg))
+        W.shape = decreasing;
+      else if(0 == strcmp("saw", optarg))
+        W.shape = sawtooth;
+      else
+        W.shape = randomS;
+      break;
+    case 'd':
+      if(0 == strcmp("normal", optarg))
+        W.dist = normal;
+      else if(0 == strcmp("geometric", optarg))
+        W.dist = geometric;
+      else
+        W.dist = uniform;
+      break;
+    case 'r':
+      W.range = atoi(optarg);
+      break;
+    case 'p':
+      W.period = atoi(optarg);
+      break;
+    case 'm':
+      W.markP = atoi(optarg);
+      break;
+    case 'q':
+      W.queryP = atoi(optarg);
+      break;
+    case 'g':
+      W.rangeP = atoi(optarg);
+      break;
+    case 'b':
+      W.batchP = atoi(optarg);
+      break;
+    case 'k':
+      W.batchK = atoi(optarg);
+      break;
+    case 't':
+      W.topP = atoi(optarg);
+      break;
+    case 'T':
+      W.topK = atoi(optarg);
+      break;
+    case 'x':
+      W.closeP = atoi(optarg);
+      break;
+    case 'o':
+      W.open = atoi(optarg);
+      break;
+    case 'c':
+      if(0 == strcmp("lifo", optarg))
+        W.order = lifo;
+      else if(0 == strcmp("random", optarg))
+        W.order = randomO;
+      else if(0 == strcmp("window", optarg))
+        W.order = window;
+      else
+        W.order = fifo;
+      break;
+    case 'w':
+      W.win = atoi(optarg);
+      break;
+    case 'S':
+      W.seed = strtoull(optarg, NULL, 10);
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if(W.n < W.open) /* Never more open marks than values */
+    W.open = W.n;
+  assert(0 < W.n && W.n < INT_MAX && "Positions must fit an int.");
+  assert(0 < W.open && 0 < W.range && 0 < W.period && 0 < W.win
+         && 0 != W.seed && 0 <= W.markP && 0 <= W.queryP && 0 <= W.rangeP
+         && 0 <= W.closeP && 0 <= W.topP && 0 < W.topK
+         && (long long)W.period*W.range < INT_MAX/2 && "Invalid workload.");
+
+  /* The header holds the number of marks. On a file write it at the end, */
+  /* otherwise count the marks with a first silent pass. */
+  off_t start = lseek(1, 0, SEEK_CUR);
+  long long q;
+  if(0 > start){
+    silent = 1;
+    q = generate(&W);
+    silent = 0;
+    pushInt((int)q);
+    generate(&W);
+    flushInts();
+  } else {
+    pushInt(0);
+    q = generate(&W);
+    flushInts();
+    int h = (int)q;
+    ssize_t wriRet = pwrite(1, &h, 4, start);
+    assert(4 == wriRet && "Broken header write.");
+    (void)wriRet;
+  }
+
+  return 0;
+}
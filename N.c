@@ -0,0 +1,167 @@
+/* MIT License */
+
+/* Copyright (c) 2021 Luís M. S. Russo */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+
+
+/* Naive baseline, keeps the whole array and scans it for every query. */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include "commands.h"
+
+#define sureInline(X) __inline X __attribute__((__gnu_inline__, __always_inline__, __artificial__))
+
+volatile int vout;
+
+char buffer[BUFSIZ];
+int *iBuffer;
+int load = 0; /* Current buffer load for Consumer */
+int bufferIdx = 0;
+
+/* The main thread actually is the consumer */
+static sureInline(int) getInt(void)
+{
+  if(0 == load){
+    int rSize = read(0, &(buffer[0]), BUFSIZ);
+    assert(0 == (rSize % 4) && "Broken integer read.");
+    load = rSize;
+
+    iBuffer = (int*)&(buffer[0]);
+    bufferIdx = 0;
+    if(0 == load) /* Prepare end of file */
+      iBuffer[bufferIdx] = EOF;
+  }
+
+  load -= 4;
+  return iBuffer[bufferIdx++];
+}
+
+int
+main(int argc, char** argv){
+
+  int a = 1024; /* Alloced positions */
+  int n = 0; /* Number of values */
+  int *A = malloc(a*sizeof(int));
+  int c; /* Character being read. */
+  int qi; /* Query index. */
+  int qj; /* Second index of ranges */
+  int k; /* Queries left in a batch */
+  int ka = 0; /* Alloced top k values */
+  int *K = NULL; /* Top k values */
+  int i;
+
+  getInt(); /* The number of marks is not needed */
+
+  c = getInt();
+  while(0 <= load){ /* There is file to read */
+    switch(c){
+    case value:
+      if(n == a){
+        a *= 2;
+        A = realloc(A, a*sizeof(int));
+        assert(NULL != A && "Failed alloc.");
+      }
+      A[n++] = getInt();
+      break;
+
+    case query: case closeQ: /* Queries */
+      qi = getInt();
+
+      vout = A[qi-1];
+      for(i = qi; i < n; i++)
+        if(A[i] < vout)
+          vout = A[i];
+
+      printf("%d ", qi);
+      printf("%d ", n-1);
+      printf("%d\n", vout);
+      break;
+    case rangeQ: /* Between two positions */
+      qi = getInt();
+      qj = getInt();
+      if(qj < qi){
+        i = qi;
+        qi = qj;
+        qj = i;
+      }
+
+      vout = A[qi-1];
+      for(i = qi; i < qj; i++)
+        if(A[i] < vout)
+          vout = A[i];
+
+      printf("%d ", qi);
+      printf("%d ", qj);
+      printf("%d\n", vout);
+      break;
+    case topkQ: /* Smallest values since a position */
+      qi = getInt();
+      qj = getInt();
+      if(ka < qj){
+        ka = qj;
+        K = realloc(K, ka*sizeof(int));
+        assert(NULL != K && "Failed alloc.");
+      }
+
+      k = 0; /* Increasing, the qj smallest so far */
+      for(i = qi-1; i < n; i++)
+        if(k < qj || A[i] < K[k-1]){
+          int j = k < qj ? k++ : k-1;
+          while(0 < j && A[i] < K[j-1]){
+            K[j] = K[j-1];
+            j--;
+          }
+          K[j] = A[i];
+        }
+
+      for(i = 0; i < k; i++){
+        printf("%d ", qi);
+        printf("%d ", n-1);
+        printf("%d\n", K[i]);
+      }
+      break;
+    case batchQ: /* Several queries */
+      for(k = getInt(); 0 < k; k--){
+        qi = getInt();
+
+        vout = A[qi-1];
+        for(i = qi; i < n; i++)
+          if(A[i] < vout)
+            vout = A[i];
+
+        printf("%d ", qi);
+        printf("%d ", n-1);
+        printf("%d\n", vout);
+      }
+      break;
+    default: /* Marks need no work */
+      break;
+    }
+    c = getInt();
+  }
+
+  free(A);
+  free(K);
+
+  return 0;
+}
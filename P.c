@@ -68,6 +68,7 @@ main(int argc, char **argv)
 
   while((c = getc(input))!= EOF){
     int nv;
+    int nk; /* Batch size */
     switch(c){
     case 'V':
       pushInt(value);
@@ -87,6 +88,29 @@ main(int argc, char **argv)
       fscanf(input, "%d", &nv);
       pushInt(nv);
       break;
+    case 'R':
+      pushInt(rangeQ);
+      fscanf(input, "%d", &nv);
+      pushInt(nv);
+      fscanf(input, "%d", &nv);
+      pushInt(nv);
+      break;
+    case 'K':
+      pushInt(topkQ);
+      fscanf(input, "%d", &nv);
+      pushInt(nv);
+      fscanf(input, "%d", &nv);
+      pushInt(nv);
+      break;
+    case 'B':
+      pushInt(batchQ);
+      fscanf(input, "%d", &nk);
+      pushInt(nk);
+      while(0 < nk--){
+        fscanf(input, "%d", &nv);
+        pushInt(nv);
+      }
+      break;
     }
   }
 
@@ -0,0 +1,165 @@
+/* MIT License */
+
+/* Copyright (c) 2021 Luís M. S. Russo */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+
+
+/* Runs an engine over shared memory rings instead of pipes. */
+
+/* Usage: ./R engine [options] < bIn */
+
+/* R creates the rings /rmq<pid>-in and /rmq<pid>-out and starts */
+/* ./engine options -i /rmq<pid>. The main thread copies stdin into the */
+/* in ring, a second thread prints the answers of the out ring as the */
+/* engine does. When the engine exits before reading all of stdin R */
+/* stops with its exit status. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sys/wait.h>
+
+#include "commands.h"
+#include "ring.h"
+
+#define RSIZE (1 << 20) /* Integers per ring */
+
+static void *
+printer(void *arg
+        )
+{ /* Prints the answers of the out ring */
+  ring r = arg;
+  int *P;
+  unsigned int n;
+  int A[3]; /* Answer, may straddle two reads */
+  int k = 0;
+
+  while(0 < (n = ringRead(r, &P))){
+    for(unsigned int j = 0; j < n; j++){
+      A[k++] = P[j];
+      if(3 == k){
+        printf("%d %d %d\n", A[0], A[1], A[2]);
+        k = 0;
+      }
+    }
+    ringRelease(r, n);
+  }
+  assert(0 == k && "Broken answer.");
+
+  return NULL;
+}
+
+static int
+feed(ring in,
+     pid_t pid, /* The engine */
+     int *status
+     )
+{ /* Copies stdin into the in ring, returns 0 at its end, or 1 with the */
+  /* status of the engine when it exits first and the ring is full */
+  int X[BUFSIZ/sizeof(int)];
+  int rest = 0; /* Bytes of an integer split across reads */
+  ssize_t rSize;
+
+  while(0 < (rSize = read(0, (char *)X + rest, sizeof(X) - rest))){
+    rSize += rest;
+    int *P = X;
+    unsigned int n = rSize/4;
+    while(0 < n){
+      unsigned int m = ringPut(in, P, n);
+      if(0 == m){ /* Full, nobody may read it */
+        if(pid == waitpid(pid, status, WNOHANG))
+          return 1;
+        ringWaitRoom(in);
+      }
+      P += m;
+      n -= m;
+    }
+    rest = rSize % 4;
+    memmove(X, (char *)X + rSize - rest, rest);
+  }
+  assert(0 == rest && "Broken integer read.");
+
+  return 0;
+}
+
+int
+main(int argc,
+     char **argv
+     )
+{
+  if(argc < 2){
+    fprintf(stderr, "Usage: %s engine [options] < file\n", argv[0]);
+    return 1;
+  }
+
+  char name[64];
+  char inName[80];
+  char outName[80];
+  snprintf(name, sizeof(name), "/rmq%d", (int)getpid());
+  snprintf(inName, sizeof(inName), "%s-in", name);
+  snprintf(outName, sizeof(outName), "%s-out", name);
+  ring in = ringCreate(inName, RSIZE);
+  ring out = ringCreate(outName, RSIZE);
+
+  pid_t pid = fork();
+  assert(0 <= pid && "Failed fork.");
+  if(0 == pid){ /* Child, ./engine options -i name */
+    char path[256];
+    char **A = malloc((argc + 3)*sizeof(char *));
+    snprintf(path, sizeof(path), "./%s", argv[1]);
+    A[0] = path;
+    for(int j = 2; j < argc; j++)
+      A[j-1] = argv[j];
+    A[argc-1] = "-i";
+    A[argc] = name;
+    A[argc+1] = NULL;
+    execv(A[0], A);
+    _exit(127);
+  }
+
+  pthread_t t;
+  int r = pthread_create(&t, NULL, printer, out);
+  assert(0 == r && "Failed thread.");
+  (void)r;
+
+  int status;
+  int early = feed(in, pid, &status); /* The engine exited first */
+  if(early)
+    fprintf(stderr, "%s stopped before the end of its input.\n", argv[1]);
+  else {
+    ringClose(in);
+    waitpid(pid, &status, 0);
+  }
+  int ret = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+  if(early && 0 == ret) /* Its input was not read */
+    ret = 1;
+  if(0 != ret)
+    ringClose(out); /* The engine did not, stop the printer */
+  pthread_join(t, NULL);
+
+  ringUnmap(in);
+  ringUnmap(out);
+  shm_unlink(inName);
+  shm_unlink(outName);
+
+  return ret;
+}
@@ -0,0 +1,369 @@
+/* MIT License */
+
+/* Copyright (c) 2021 Luís M. S. Russo */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+
+
+/* Static range minimum index over a fixed array. */
+
+/* The values of a binary command file are split into blocks of 32. For */
+/* every position j the bit mask M[j] marks the positions of its block, up */
+/* to j, that are on the stack of suffix minima, so the lowest mask bit at */
+/* or after i is the minimum of [i, j]. A sparse table over the block */
+/* minima answers the blocks in between, every query costs O(1). The index */
+/* is written to a file and mapped back, without any parsing. */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "commands.h"
+
+#define sureInline(X) __inline X __attribute__((__gnu_inline__, __always_inline__, __artificial__))
+
+#define BBITS 5 /* Block of 32 positions */
+#define BSIZE (1 << BBITS)
+#define MAGIC 0x534d5152 /* RQMS */
+
+volatile int vout;
+
+char buffer[BUFSIZ];
+int *iBuffer;
+int load = 0; /* Current buffer load for Consumer */
+int bufferIdx = 0;
+
+static sureInline(int) getInt(void)
+{
+  if(0 == load){
+    int rSize = read(0, &(buffer[0]), BUFSIZ);
+    assert(0 == (rSize % 4) && "Broken integer read.");
+    load = rSize;
+
+    iBuffer = (int*)&(buffer[0]);
+    bufferIdx = 0;
+    if(0 == load) /* Prepare end of file */
+      iBuffer[bufferIdx] = EOF;
+  }
+
+  load -= 4;
+  return iBuffer[bufferIdx++];
+}
+
+struct header{
+  int magic;
+  int lv; /* Levels of the sparse table */
+  long long n; /* Number of values */
+  long long nb; /* Number of blocks */
+};
+
+struct index{
+  struct header *h;
+  int *A; /* The values */
+  unsigned int *M; /* Suffix minima masks */
+  int *T; /* Sparse table, lv rows of nb block minima */
+  size_t bytes; /* Mapped size */
+};
+
+static size_t
+indexBytes(struct header *h
+           )
+{
+  return sizeof(struct header)
+    + (size_t)h->n*(sizeof(int) + sizeof(unsigned int))
+    + (size_t)h->lv*h->nb*sizeof(int);
+}
+
+static void
+indexLay(struct index *I,
+         void *base
+         )
+{ /* Points the arrays into the file image */
+  I->h = base;
+  I->A = (int *)(I->h + 1);
+  I->M = (unsigned int *)(I->A + I->h->n);
+  I->T = (int *)(I->M + I->h->n);
+}
+
+static void
+build(char *file
+      )
+{ /* Reads the values of a command file from stdin */
+  struct header h;
+  struct index I;
+  size_t a = 1024; /* Alloced positions */
+  int *A = malloc(a*sizeof(int));
+  unsigned int m = 0; /* Mask of the current block */
+  int S[BSIZE]; /* Stack of block offsets */
+  int s = 0; /* Stack size */
+  int c;
+  long long j;
+  int k;
+  size_t w;
+  FILE *f;
+
+  h.magic = MAGIC;
+  h.n = 0;
+  getInt(); /* The number of marks is not needed */
+  c = getInt();
+  while(0 <= load){
+    switch(c){
+    case value:
+      if((size_t)h.n == a){
+        a *= 2;
+        A = realloc(A, a*sizeof(int));
+        assert(NULL != A && "Failed alloc.");
+      }
+      A[h.n++] = getInt();
+      break;
+    case query: case closeQ:
+      getInt();
+      break;
+    case rangeQ: case topkQ:
+      getInt();
+      getInt();
+      break;
+    case batchQ:
+      for(k = getInt(); 0 < k; k--)
+        getInt();
+      break;
+    default: /* Marks carry no argument */
+      break;
+    }
+    c = getInt();
+  }
+
+  h.nb = (h.n + BSIZE - 1) >> BBITS;
+  h.lv = 0;
+  while((1LL << h.lv) <= h.nb)
+    h.lv++;
+
+  I.bytes = indexBytes(&h);
+  void *base = malloc(I.bytes);
+  assert(NULL != base && "Failed alloc.");
+  memcpy(base, &h, sizeof(h));
+  indexLay(&I, base);
+  memcpy(I.A, A, h.n*sizeof(int));
+  free(A);
+
+  for(j = 0; j < h.n; j++){
+    if(0 == (j & (BSIZE-1))){
+      s = 0;
+      m = 0;
+      I.T[j >> BBITS] = INT_MAX;
+    }
+    while(0 < s && I.A[j] < I.A[(j & ~(BSIZE-1)) + S[s-1]])
+      m &= ~(1u << S[--s]);
+    S[s++] = j & (BSIZE-1);
+    m |= 1u << (j & (BSIZE-1));
+    I.M[j] = m;
+    if(I.A[j] < I.T[j >> BBITS])
+      I.T[j >> BBITS] = I.A[j];
+  }
+
+  for(k = 1; k < h.lv; k++)
+    for(j = 0; j + (1LL << k) <= h.nb; j++){
+      int *L = &I.T[(k-1)*h.nb];
+      I.T[k*h.nb + j] = L[j] < L[j + (1LL << (k-1))] ?
+        L[j] : L[j + (1LL << (k-1))];
+    }
+
+  f = fopen(file, "wb");
+  assert(NULL != f && "Can not create index.");
+  w = fwrite(base, 1, I.bytes, f);
+  assert(I.bytes == w && "Broken index write.");
+  (void)w;
+  fclose(f);
+  free(base);
+}
+
+static void
+indexMap(struct index *I,
+         char *file
+         )
+{
+  struct stat st;
+  int fd;
+  void *base;
+
+  fd = open(file, O_RDONLY);
+  assert(-1 != fd && "Can not open index.");
+  fstat(fd, &st);
+  assert(sizeof(struct header) <= (size_t)st.st_size && "Broken index.");
+  base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  assert(MAP_FAILED != base && "Can not map index.");
+  close(fd);
+
+  indexLay(I, base);
+  I->bytes = st.st_size;
+  assert(MAGIC == I->h->magic && "Not an index.");
+  assert(indexBytes(I->h) == I->bytes && "Broken index.");
+}
+
+static sureInline(int) inBlock(struct index *I,
+                               long long i,
+                               long long j
+                               )
+{ /* Minimum of [i, j], both inside one block */
+  unsigned int m = I->M[j] & (~0u << (i & (BSIZE-1)));
+
+  return I->A[(j & ~(BSIZE-1)) + __builtin_ctz(m)];
+}
+
+static int
+rmq(struct index *I,
+    long long i,
+    long long j
+    )
+{ /* Minimum of [i, j], with i <= j */
+  long long bi = i >> BBITS;
+  long long bj = j >> BBITS;
+  int r;
+  int v;
+  int k;
+
+  if(bi == bj)
+    return inBlock(I, i, j);
+
+  r = inBlock(I, i, i | (BSIZE-1));
+  v = inBlock(I, j & ~(BSIZE-1), j);
+  if(v < r)
+    r = v;
+
+  if(bi + 1 < bj){
+    k = 63 - __builtin_clzll(bj - bi - 1);
+    v = I->T[k*I->h->nb + bi + 1];
+    if(v < r)
+      r = v;
+    v = I->T[k*I->h->nb + bj - (1LL << k)];
+    if(v < r)
+      r = v;
+  }
+
+  return r;
+}
+
+static unsigned long long seed = 1;
+
+static unsigned int
+rnd(void)
+{ /* xorshift64*, same stream as G */
+  seed ^= seed >> 12;
+  seed ^= seed << 25;
+  seed ^= seed >> 27;
+
+  return (seed * 2685821657736338717ULL) >> 32;
+}
+
+static void
+usage(char *name)
+{
+  fprintf(stderr,
+          "Usage: %s -b index < commands\n"
+          "       %s [options] index < queries\n"
+          "  -b index      build the index from the values of a command file\n"
+          "  -r queries    answer random queries instead of reading them\n"
+          "  -S seed       random seed (1)\n"
+          "  -q            only print the number of answers\n",
+          name, name);
+}
+
+int
+main(int argc, char **argv)
+{
+  struct index I;
+  char *out = NULL; /* Index to build */
+  long long r = -1; /* Random queries */
+  long long a = 0; /* Answers */
+  int quiet = 0;
+  int opt;
+  long long i;
+  long long j;
+  long long t;
+
+  while(-1 != (opt = getopt(argc, argv, "b:r:S:q"))){
+    switch(opt){
+    case 'b':
+      out = optarg;
+      break;
+    case 'r':
+      r = atoll(optarg);
+      break;
+    case 'S':
+      seed = strtoull(optarg, NULL, 10);
+      break;
+    case 'q':
+      quiet = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if(NULL != out){
+    build(out);
+    return 0;
+  }
+
+  if(optind != argc - 1){
+    usage(argv[0]);
+    return 1;
+  }
+
+  indexMap(&I, argv[optind]);
+  assert((0 < I.h->n || 0 == r) && "Empty index.");
+
+  while(0 != r){
+    if(0 < r){
+      i = rnd() % I.h->n;
+      j = rnd() % I.h->n;
+      r--;
+    } else {
+      i = getInt();
+      j = getInt();
+      if(0 > load)
+        break;
+      assert(0 <= i && i < I.h->n && 0 <= j && j < I.h->n
+             && "Query out of range.");
+    }
+    if(j < i){
+      t = i;
+      i = j;
+      j = t;
+    }
+
+    vout = rmq(&I, i, j);
+    a++;
+    if(!quiet)
+      printf("%lld %lld %d\n", i, j, vout);
+  }
+
+  if(quiet)
+    printf("answers %lld\n", a);
+
+  munmap(I.h, I.bytes);
+
+  return 0;
+}
@@ -24,31 +24,82 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <limits.h>
 #include <assert.h>
 #include <pthread.h> /* For double buffering */
+#if defined(HUGEPAGE) || defined(SPILL)
+#include <sys/mman.h>
+#endif
 #include "commands.h"
+#include "scan.h"
+#include "stats.h"
+#include "mem.h"
+#if defined(URING)
+#include "uring.h"
+#endif
+#include "ring.h"
 
 #define sureInline(X) __inline X __attribute__((__gnu_inline__, __always_inline__, __artificial__))
 
 volatile int vout;
+int rebuilds = 0; /* Number of calls to makeNewRMQ */
+long long rebuildNs = 0; /* Time spent in them */
+int peakOpen = 0; /* Largest number of open marks */
+int marksLeft = 0; /* Marks still to come, from the header */
+int growth = 2; /* Capacity over the open marks after a rebuild */
+
+#if defined(STATS)
+struct hist cmdH[] = {{"value ns"}, {"mark ns"}, {"query ns"}, {"close ns"},
+                      {"range ns"}, {"batch ns"}, {"top k ns"}};
+struct hist probeH = {"hash probes"};
+struct hist findH = {"find path"};
+struct hist popH = {"pop depth"};
+struct hist rebuildH = {"rebuild ns"};
+
+static void
+statsDump(void)
+{
+  fprintf(stderr, "rebuilds %d\n", rebuilds);
+  fprintf(stderr, "rebuild ms %.1f\n", rebuildNs/1e6);
+  for(int i = 0; i < 7; i++)
+    histPrint(&cmdH[i]);
+  histPrint(&probeH);
+  histPrint(&findH);
+  histPrint(&popH);
+  histPrint(&rebuildH);
+}
+#endif
 
 char buffer[BUFSIZ];
 int *iBuffer;
 int load = 0; /* Current buffer load for Consumer */
 int bufferIdx = 0;
+int bufferGen = 0; /* Number of buffer reads */
 
 
 /* The main thread actually is the consumer */
 static sureInline(int) getInt(void)
 {
   if(0 == load){
-    int rSize = read(0, &(buffer[0]), BUFSIZ);
+    int rSize;
+    if(NULL != inRing)
+      rSize = ringFill(&iBuffer); /* Read in place */
+#if defined(URING)
+    else if(uringIn)
+      rSize = uringFill(&iBuffer); /* Read ahead in place */
+#endif
+    else {
+      rSize = read(0, &(buffer[0]), BUFSIZ);
+      iBuffer = (int*)&(buffer[0]);
+    }
+    if(0 == rSize)
+      iBuffer = (int*)&(buffer[0]);
     assert(0 == (rSize % 4) && "Broken integer read.");
     load = rSize;
 
-    iBuffer = (int*)&(buffer[0]);
     bufferIdx = 0;
+    bufferGen++;
     if(0 == load) /* Prepare end of file */
       iBuffer[bufferIdx] = EOF;
   }
@@ -79,9 +130,276 @@ struct hash{
 
 typedef struct hash *hash;
 
+#define BATCH 256 /* Marks of a batch query resolved together */
+
+#if defined(SOA) /* Structure of arrays, the hot loops only touch one array */
+
+struct stack{
+  int a; /* Number of positions alloced */
+  int stub; /* Last element on the stack */
+  int stubQ; /* Boolean for last call was to stub */
+  int *V; /* The value of the items. Copied from A */
+  int *Idx; /* Representing the position index of these values. */
+#if defined(STACK_UFI)
+  int *Ufi; /* UF index of the set of these values. */
+#endif
+};
+
+struct UF{
+  int a; /* Number of alloced positions */
+  int lst; /* Last position index */
+  int *Seti; /* Set index values */
+  int *Stacki; /* Stack indexes */
+};
+
+#define Sv(S, i) ((S)->V[i])
+#define Sidx(S, i) ((S)->Idx[i])
+#define Sufi(S, i) ((S)->Ufi[i])
+#define UFseti(T, i) ((T)->Seti[i])
+#define UFstacki(T, i) ((T)->Stacki[i])
+#define SvHot(S, i) Sv(S, i) /* Written items */
+#define SidxHot(S, i) Sidx(S, i)
+#define SvPrefetch(S, i) __builtin_prefetch(&Sv(S, i))
+#define SvBase(S) ((S)->V) /* Values for cut() */
+#define SSTRIDE 1
+#if defined(STACK_UFI)
+#define SITEM (3*sizeof(int)) /* Bytes per stack item */
+#else
+#define SITEM (2*sizeof(int)) /* Bytes per stack item */
+#endif
+#define UFITEM (2*sizeof(int)) /* Bytes per UF item */
+
+#elif defined(PACKED) /* Stack values and positions packed in blocks */
+
+/* The stack is split in blocks of SBLOCK items. The items near the top are */
+/* kept raw, in V and Idx. Below them every block stores its smallest */
+/* value and position and the offsets of its items from them, with as many */
+/* bits as the largest offset needs. Values in the stack do not decrease, */
+/* so the offsets are small when the values are close. Items are read in */
+/* O(1) anywhere, but written only in the raw part, which grows by */
+/* unpacking the block below it when the stack is cut that far. */
+
+#if defined(STACK_UFI)
+#error "PACKED stacks keep no set indexes, use STACK=IDX"
+#endif
+
+#define SBLOCK 32 /* Items per packed block */
+#define SRAW (3*SBLOCK) /* Raw items, a block is packed when 2 are full */
+
+struct block{
+  int v; /* Smallest value */
+  int idx; /* Smallest position */
+  int w; /* First word of the offsets in W */
+  unsigned char bv; /* Bits per value offset */
+  unsigned char bi; /* Bits per position offset */
+};
+
+struct stack{
+  int a; /* Number of positions alloced */
+  int stub; /* Last element on the stack */
+  int stubQ; /* Boolean for last call was to stub */
+  int cold; /* Items below cold are packed, a multiple of SBLOCK */
+  int V[SRAW]; /* Values of the items from cold on */
+  int Idx[SRAW]; /* Positions of the items from cold on */
+  struct block *B; /* Block i holds items i*SBLOCK on */
+  unsigned int *W; /* Offsets of the packed items, block after block */
+  int wa; /* Alloced words of W */
+  int w; /* Used words of W */
+};
+
+struct UFItem{
+  int seti; /* Set index value */
+  int stacki; /* Stack index */
+};
+
+typedef struct UFItem *UFItem;
+
+struct UF{
+  int a; /* Number of alloced positions */
+  int lst; /* Last position index */
+  UFItem L; /* List of sets */
+};
+
+static sureInline(unsigned int) unpack(const unsigned int *W,
+                                       int bit,
+                                       int b /* Bits, at most 32 */
+                                       )
+{ /* The b bits of W starting at bit, W has a word to spare */
+  unsigned long long x = W[bit >> 5] | (unsigned long long)W[(bit >> 5) + 1] << 32;
+
+  return (x >> (bit & 31)) & ((1ULL << b) - 1);
+}
+
+static sureInline(int) stackV(struct stack *S,
+                              int i
+                              )
+{
+  if(S->cold <= i)
+    return S->V[i - S->cold];
+
+  struct block *B = &S->B[i / SBLOCK];
+  return (int)((unsigned int)B->v
+               + unpack(&S->W[B->w], (i % SBLOCK)*B->bv, B->bv));
+}
+
+static sureInline(int) stackIdx(struct stack *S,
+                                int i
+                                )
+{
+  if(S->cold <= i)
+    return S->Idx[i - S->cold];
+
+  struct block *B = &S->B[i / SBLOCK];
+  return (int)((unsigned int)B->idx
+               + unpack(&S->W[B->w], SBLOCK*B->bv + (i % SBLOCK)*B->bi, B->bi));
+}
+
+static int
+offsetBits(const int *X,
+           int *m /* Smallest of X */
+           )
+{ /* Bits for the largest offset of the SBLOCK items of X from their smallest */
+  unsigned int d = 0;
+  int j;
+
+  *m = X[0];
+  for(j = 1; j < SBLOCK; j++)
+    if(X[j] < *m)
+      *m = X[j];
+  for(j = 0; j < SBLOCK; j++)
+    if(d < (unsigned int)X[j] - (unsigned int)*m)
+      d = (unsigned int)X[j] - (unsigned int)*m;
+
+  return 0 == d ? 0 : 32 - __builtin_clz(d);
+}
+
+static void
+packOffsets(unsigned int *W,
+            int bit,
+            const int *X,
+            int m, /* Base of the offsets */
+            int b /* Bits per offset */
+            )
+{
+  for(int j = 0; j < SBLOCK; j++, bit += b){
+    unsigned int x = (unsigned int)X[j] - (unsigned int)m;
+    W[bit >> 5] |= x << (bit & 31);
+    if(32 < (bit & 31) + b)
+      W[(bit >> 5) + 1] |= x >> (32 - (bit & 31));
+  }
+}
+
+static void
+packBlock(struct stack *S
+          )
+{ /* Moves the lowest SBLOCK raw items into a new packed block */
+  struct block *B = &S->B[S->cold / SBLOCK];
+  int n; /* Words of the block */
+
+  B->bv = offsetBits(S->V, &B->v);
+  B->bi = offsetBits(S->Idx, &B->idx);
+  n = (SBLOCK*(B->bv + B->bi) + 31) / 32;
+  if(S->wa < S->w + n + 1){ /* One word to spare for unpack */
+    int wa = 2*(S->w + n + 1);
+    S->W = realloc(S->W, wa*sizeof(int));
+    assert(NULL != S->W && "Failed alloc.");
+    memAdd(memStack, (long long)(wa - S->wa)*sizeof(int));
+    S->wa = wa;
+  }
+  B->w = S->w;
+  memset(&S->W[B->w], 0, (n + 1)*sizeof(int));
+  packOffsets(&S->W[B->w], 0, S->V, B->v, B->bv);
+  packOffsets(&S->W[B->w], SBLOCK*B->bv, S->Idx, B->idx, B->bi);
+  S->w += n;
+
+  memmove(S->V, S->V + SBLOCK, (SRAW - SBLOCK)*sizeof(int));
+  memmove(S->Idx, S->Idx + SBLOCK, (SRAW - SBLOCK)*sizeof(int));
+  S->cold += SBLOCK;
+}
+
+static void
+unpackBlock(struct stack *S
+            )
+{ /* Moves the highest packed block back to the raw items */
+  struct block *B = &S->B[S->cold / SBLOCK - 1];
+  int n = S->stub + 1 - S->cold; /* Raw items in use, with the stub */
+  int j;
+
+  if(n < 0)
+    n = 0;
+  assert(n + SBLOCK <= SRAW && "Raw stack overflow.");
+  memmove(S->V + SBLOCK, S->V, n*sizeof(int));
+  memmove(S->Idx + SBLOCK, S->Idx, n*sizeof(int));
+  for(j = 0; j < SBLOCK; j++){
+    S->V[j] = (int)((unsigned int)B->v
+                    + unpack(&S->W[B->w], j*B->bv, B->bv));
+    S->Idx[j] = (int)((unsigned int)B->idx
+                      + unpack(&S->W[B->w], SBLOCK*B->bv + j*B->bi, B->bi));
+  }
+  S->w = B->w;
+  S->cold -= SBLOCK;
+}
+
+static sureInline(void) stackRoom(struct stack *S,
+                                   int i /* Next item */
+                                   )
+{ /* Packs a block when the raw items are full */
+  if(2*SBLOCK <= i - S->cold)
+    packBlock(S);
+}
+
+static void
+stackHot(struct stack *S,
+         int i
+         )
+{ /* Makes item i raw, so it can be written */
+  while(i < S->cold)
+    unpackBlock(S);
+}
+
+static int
+stackCut(struct stack *S,
+         int i,
+         int v
+         )
+{ /* cut() over the raw items and then over the packed blocks */
+  int b;
+
+  if(S->cold <= i){
+    if(0 == S->cold || S->V[0] < v) /* Item 0 holds INT_MIN */
+      return S->cold + cut(S->V, 1, i - S->cold, v);
+    i = S->cold - 1;
+  }
+
+  b = i / SBLOCK;
+  while(v <= S->B[b].v) /* The whole block is cut */
+    b--;
+  if(b < i / SBLOCK)
+    i = b*SBLOCK + SBLOCK - 1;
+  while(v <= stackV(S, i))
+    i--;
+
+  return i;
+}
+
+#define Sv(S, i) stackV(S, i)
+#define Sidx(S, i) stackIdx(S, i)
+#define SvHot(S, i) ((S)->V[(i) - (S)->cold])
+#define SidxHot(S, i) ((S)->Idx[(i) - (S)->cold])
+#define SvPrefetch(S, i)
+#define UFseti(T, i) ((T)->L[i].seti)
+#define UFstacki(T, i) ((T)->L[i].stacki)
+#define SITEM 0 /* Bytes per stack item, W is counted as it grows */
+#define UFITEM sizeof(struct UFItem) /* Bytes per UF item */
+
+#else /* Array of structures */
+
 struct stackItem{
   int v; /* The value of the item. Copied from A */
   int idx; /* Representing the position index of this value. */
+#if defined(STACK_UFI)
+  int ufi; /* UF index of the set of this value. */
+#endif
 };
 
 typedef struct stackItem *stackItem;
@@ -93,8 +411,6 @@ struct stack{
   stackItem M; /* Point to the actual stack */
 };
 
-typedef struct stack* stack;
-
 struct UFItem{
   int seti; /* Set index value */
   int stacki; /* Stack index */
@@ -107,15 +423,75 @@ struct UF{
   int lst; /* Last position index */
   UFItem L; /* List of sets */
 };
+
+#define Sv(S, i) ((S)->M[i].v)
+#define Sidx(S, i) ((S)->M[i].idx)
+#define Sufi(S, i) ((S)->M[i].ufi)
+#define UFseti(T, i) ((T)->L[i].seti)
+#define UFstacki(T, i) ((T)->L[i].stacki)
+#define SvHot(S, i) Sv(S, i) /* Written items */
+#define SidxHot(S, i) Sidx(S, i)
+#define SvPrefetch(S, i) __builtin_prefetch(&Sv(S, i))
+#define SvBase(S) (&(S)->M[0].v) /* Values for cut() */
+#define SSTRIDE (sizeof(struct stackItem)/sizeof(int))
+#define SITEM sizeof(struct stackItem) /* Bytes per stack item */
+#define UFITEM sizeof(struct UFItem) /* Bytes per UF item */
+
+#endif /* SOA */
+
+#if defined(STACK_UFI) /* Stack items know their set */
+#define stackSet(F, i) Sufi((F)->S, i)
+#else
+#define stackSet(F, i) get((F)->H, Sidx((F)->S, i))
+#endif
+
+typedef struct stack* stack;
+
 /* A union find array */
 /* Negative numbers are ranks. Positive numbers are pointers */
 typedef struct UF *UF;
 
+#if defined(RANGE)
+struct ranges{ /* Open marks in position order, indexed like the UF */
+  int tail; /* Last open mark, 0 when there is none */
+  int *G; /* Minimum from this mark to the next one, both included */
+  int *Val; /* Value at the mark */
+  int *Prev; /* Previous open mark */
+  int *Next; /* Next open mark */
+  int cap; /* Marks of the UF */
+  int n; /* Ranks given */
+  int *Rank; /* Position order of a mark */
+  int *Tree; /* Segment tree of the minima G, leaves from cap by rank */
+};
+
+typedef struct ranges *ranges;
+#endif /* RANGE */
+
+#if defined(TOPK)
+struct topk{ /* Groups of open marks with the same k smallest values */
+  int k; /* Values kept per group */
+  int top; /* Last group, 0 when there is none */
+  int *Seti; /* Union find of the marks, indexed like the UF */
+  int *Gi; /* Group of a root */
+  int *Gufi; /* A mark of each group */
+  int *C; /* Values of each group, up to k */
+  int *L; /* The smallest values since the marks of a group, increasing */
+};
+
+typedef struct topk *topk;
+#endif /* TOPK */
+
 struct fastRMQ{
   int pos; /* Current position in array */
   stack S;
   hash H;
   UF T;
+#if defined(RANGE)
+  ranges R;
+#endif
+#if defined(TOPK)
+  topk K;
+#endif
 };
 
 typedef struct fastRMQ *fastRMQ;
@@ -138,7 +514,10 @@ makeHash(int n
   h = malloc(sizeof(struct hash));
   h->a = primes[i];
   h->n = 0;
-  h->T = calloc(h->a, sizeof(struct hashItem));
+  h->T = cacheAlloc(h->a*sizeof(struct hashItem));
+  /* Written here, so the pages belong to the node of this thread */
+  memset(h->T, 0, h->a*sizeof(struct hashItem));
+  memAdd(memHash, sizeof(struct hash) + h->a*sizeof(struct hashItem));
 
   return h;
 }
@@ -147,7 +526,8 @@ void
 freeHash(hash *H
          )
 {
-  free((*H)->T);
+  memAdd(memHash, -(sizeof(struct hash) + (*H)->a*sizeof(struct hashItem)));
+  cacheFree((*H)->T, (*H)->a*sizeof(struct hashItem));
   (*H)->T=NULL;
   free(*H);
   *H = NULL;
@@ -174,21 +554,32 @@ hashFun(int key,
 }
 
 static int
-findPosition(hash h,
-             int key
-             )
+probe(hash h,
+      int key,
+      int i /* Starting slot */
+      )
 {
-  int i = hashFun(key, h->a);
+  STAT(int len = 1;)
 
   while(0 != h->T[i].key
         && h->T[i].key != key){
     i++;
     i %= h->a;
+    STAT(len++;)
   }
 
+  STAT(histRecord(&probeH, len);)
   return i;
 }
 
+static int
+findPosition(hash h,
+             int key
+             )
+{
+  return probe(h, key, hashFun(key, h->a));
+}
+
 int
 get(hash h,
         int key
@@ -234,6 +625,50 @@ markDelete(hash h,
   h->n--;
 }
 
+#if defined(SPILL)
+/* The stack lives in a mapped file, so the kernel can write its cold */
+/* bottom back to disk and read it again when a large drop reaches it. */
+/* Indexes into the stack are unchanged, the hash and union find do not */
+/* know. */
+
+char *spillDir = "."; /* Where stack files are created, must be on disk */
+
+void *
+stackAlloc(size_t n
+           )
+{ /* Alloc n bytes in a new file, which is unlinked at once */
+  char name[4096];
+  int fd;
+  void *r;
+
+  snprintf(name, sizeof(name), "%s/T2stackXXXXXX", spillDir);
+  fd = mkstemp(name);
+  assert(-1 != fd && "Failed spill file.");
+  unlink(name);
+
+  n = (n + HUGESIZE - 1) / HUGESIZE * HUGESIZE;
+  int t = ftruncate(fd, n);
+  assert(0 == t && "Failed spill file.");
+  (void)t;
+  r = mmap(NULL, n, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  assert(MAP_FAILED != r && "Failed spill map.");
+  close(fd);
+
+  return r;
+}
+
+void
+stackFree(void *p,
+          size_t n /* Bytes given to stackAlloc */
+          )
+{
+  munmap(p, (n + HUGESIZE - 1) / HUGESIZE * HUGESIZE);
+}
+#else
+#define stackAlloc cacheAlloc
+#define stackFree cacheFree
+#endif /* SPILL */
+
 stack makeStack(int n)
 {
   stack S = NULL;
@@ -242,9 +677,26 @@ stack makeStack(int n)
   S->a = n+2; /*  */
   S->stub = 0;
   S->stubQ = 0; /* means false */
-  S->M = malloc(S->a*sizeof(struct stackItem));
-  S->M[0].v = INT_MIN;
-  S->M[0].idx = 0; /* Simple clean value */
+#if defined(SOA)
+  S->V = stackAlloc(S->a*sizeof(int));
+  S->Idx = stackAlloc(S->a*sizeof(int));
+#if defined(STACK_UFI)
+  S->Ufi = stackAlloc(S->a*sizeof(int));
+#endif
+#elif defined(PACKED)
+  S->cold = 0;
+  S->B = malloc((S->a/SBLOCK + 1)*sizeof(struct block));
+  S->wa = 64;
+  S->w = 0;
+  S->W = malloc(S->wa*sizeof(int));
+  memAdd(memStack, (S->a/SBLOCK + 1)*sizeof(struct block)
+         + S->wa*sizeof(int));
+#else
+  S->M = stackAlloc(S->a*sizeof(struct stackItem));
+#endif
+  memAdd(memStack, sizeof(struct stack) + S->a*SITEM);
+  SvHot(S, 0) = INT_MIN;
+  SidxHot(S, 0) = 0; /* Simple clean value */
   Push(S);
 
   return S;
@@ -252,31 +704,48 @@ stack makeStack(int n)
 
 void freeStack(stack *S)
 {
-  free((*S)->M);
+  memAdd(memStack, -(sizeof(struct stack) + (*S)->a*SITEM));
+#if defined(SOA)
+  stackFree((*S)->V, (*S)->a*sizeof(int));
+  stackFree((*S)->Idx, (*S)->a*sizeof(int));
+#if defined(STACK_UFI)
+  stackFree((*S)->Ufi, (*S)->a*sizeof(int));
+#endif
+#elif defined(PACKED)
+  memAdd(memStack, -(((*S)->a/SBLOCK + 1)*sizeof(struct block)
+                     + (*S)->wa*sizeof(int)));
+  free((*S)->B);
+  free((*S)->W);
+#else
+  stackFree((*S)->M, (*S)->a*sizeof(struct stackItem));
   (*S)->M = NULL;
+#endif
   free(*S);
   *S = NULL;
 }
 
-stackItem
+int
 STop(stack S)
 {
   S->stubQ = 0; /* means false */
-  return &(S->M[S->stub - 2]);
+  return S->stub - 2;
 }
 
-stackItem
+int
 Top(stack S)
 {
   S->stubQ = 0; /* means false */
-  return &(S->M[S->stub - 1]);
+  return S->stub - 1;
 }
 
-stackItem
+int
 getStub(stack S)
 {
   S->stubQ = 1; /* means true */
-  return &(S->M[S->stub]);
+#if defined(PACKED)
+  stackRoom(S, S->stub);
+#endif
+  return S->stub;
 }
 
 int
@@ -292,6 +761,13 @@ Pop(stack S)
   S->stub--;
 }
 
+void
+PopTo(stack S, int t)
+{ /* Pops elements until t is the top */
+  S->stubQ = 0; /* means false */
+  S->stub = t + 1;
+}
+
 UF makeUF(int n)
 {
   UF T = NULL;
@@ -299,12 +775,18 @@ UF makeUF(int n)
   T = malloc(sizeof(struct UF));
   T->a = n+1;
   T->lst = 1; /* Need to waste position 0 for hash value consistency */
-  T->L = (UFItem) malloc((T->a)*sizeof(struct UFItem));
+#if defined(SOA)
+  T->Seti = cacheAlloc((T->a)*sizeof(int));
+  T->Stacki = cacheAlloc((T->a)*sizeof(int));
+#else
+  T->L = cacheAlloc((T->a)*sizeof(struct UFItem));
+#endif
+  memAdd(memUF, sizeof(struct UF) + T->a*UFITEM);
 
   int i; /* Counter */
   i = 0;
   while(i < T->a){
-    T->L[i].seti = -1; /* Initial rank */
+    UFseti(T, i) = -1; /* Initial rank */
     i++;
   }
 
@@ -313,59 +795,233 @@ UF makeUF(int n)
 
 void freeUF(UF *T)
 {
-  free((*T)->L);
+  memAdd(memUF, -(sizeof(struct UF) + (*T)->a*UFITEM));
+#if defined(SOA)
+  cacheFree((*T)->Seti, (*T)->a*sizeof(int));
+  cacheFree((*T)->Stacki, (*T)->a*sizeof(int));
+#else
+  cacheFree((*T)->L, (*T)->a*sizeof(struct UFItem));
   (*T)->L = NULL;
+#endif
   free(*T);
   *T = NULL;
 }
 
 int Find(UF T, int q)
 {
-  UFItem A = T->L;
-
-  static int LA[35]; /* Iterative find */
-  int i;
   int p = q;
+  STAT(int len = 0;)
 
-  i = 0;
-  while(0 <= A[p].seti){
-    LA[i] = p;
-    i++;
-    p = A[p].seti; /* Move up */
+#if defined(FIND_COMPRESS)
+  while(0 <= UFseti(T, p)){
+    p = UFseti(T, p); /* Move up */
+    STAT(len++;)
   }
 
-  assert(i < 35 && "Hit limit");
-
-  while(i > 0){
-    i--;
-    A[LA[i]].seti = p;
+  while(q != p){ /* Second pass, point the path to the root */
+    int n = UFseti(T, q);
+    UFseti(T, q) = p;
+    q = n;
   }
+#elif defined(FIND_SPLIT)
+  while(0 <= UFseti(T, p)){ /* Every node points to its grandparent */
+    int n = UFseti(T, p);
+    if(0 <= UFseti(T, n))
+      UFseti(T, p) = UFseti(T, n);
+    p = n; /* Move up */
+    STAT(len++;)
+  }
+#else /* Path halving */
+  while(0 <= UFseti(T, p)){ /* Every other node points to its grandparent */
+    int n = UFseti(T, p);
+    if(0 <= UFseti(T, n)){
+      UFseti(T, p) = UFseti(T, n);
+      n = UFseti(T, n);
+    }
+    p = n; /* Move up */
+    STAT(len++;)
+  }
+#endif
 
+  STAT(histRecord(&findH, len);)
   return p;
 }
 
+int Link(UF T, int r, int p)
+{ /* Links roots r and p by rank, returns the new root */
+  if(UFseti(T, p) < UFseti(T, r)){
+    UFseti(T, r) = p;
+    return p;
+  }
+
+  if(UFseti(T, p) == UFseti(T, r))
+    UFseti(T, r)--;
+  UFseti(T, p) = r;
+
+  return r;
+}
+
 void Union(UF T, int p, int q)
 {
   int rp = Find(T, p);
   int rq = Find(T, q);
 
   if(rp != rq){
-    UFItem A = T->L;
+    Link(T, rq, rp);
 
-    if(A[rp].seti < A[rq].seti)
-      A[rq].seti = rp;
-    else {
-      if(A[rp].seti == A[rq].seti)
-        A[rq].seti--;
-      A[rp].seti = rq;
+    if(UFstacki(T, rp) > UFstacki(T, rq))
+      UFstacki(T, rp) = UFstacki(T, rq);
+    else
+      UFstacki(T, rq) = UFstacki(T, rp);
+  }
+}
+
+#if defined(RANGE)
+ranges makeRanges(int n)
+{
+  ranges R = NULL;
+
+  R = malloc(sizeof(struct ranges));
+  R->tail = 0;
+  R->G = malloc(n*sizeof(int));
+  R->Val = malloc(n*sizeof(int));
+  R->Prev = malloc(n*sizeof(int));
+  R->Next = malloc(n*sizeof(int));
+  R->cap = n;
+  R->n = 0;
+  R->Rank = malloc(n*sizeof(int));
+  R->Tree = malloc(2*n*sizeof(int));
+  for(int i = 0; i < 2*n; i++)
+    R->Tree[i] = INT_MAX; /* No gap */
+  memAdd(memRange, sizeof(struct ranges) + 7*n*sizeof(int));
+
+  return R;
+}
+
+void freeRanges(ranges *R, int n)
+{
+  memAdd(memRange, -(sizeof(struct ranges) + 7*n*sizeof(int)));
+  free((*R)->G);
+  free((*R)->Val);
+  free((*R)->Prev);
+  free((*R)->Next);
+  free((*R)->Rank);
+  free((*R)->Tree);
+  free(*R);
+  *R = NULL;
+}
+
+static void
+rangeSet(ranges R, int r, int v)
+{ /* Leaf of rank r is v */
+  r += R->cap;
+  R->Tree[r] = v;
+  for(r /= 2; 0 < r; r /= 2)
+    R->Tree[r] = R->Tree[2*r] < R->Tree[2*r+1] ? R->Tree[2*r] : R->Tree[2*r+1];
+}
+
+static int
+rangeMin(ranges R, int a, int b)
+{ /* Minimum of the leaves of ranks a to b-1 */
+  int v = INT_MAX;
+
+  for(a += R->cap, b += R->cap; a < b; a /= 2, b /= 2){
+    if(a & 1){
+      if(R->Tree[a] < v)
+        v = R->Tree[a];
+      a++;
+    }
+    if(b & 1){
+      b--;
+      if(R->Tree[b] < v)
+        v = R->Tree[b];
+    }
+  }
+
+  return v;
+}
+
+static void
+rangeTree(ranges R, int n)
+{ /* Ranks and tree of the n open marks after a rebuild */
+  int u = R->tail;
+
+  R->n = n;
+  while(0 != u){ /* Backwards in position order */
+    R->Rank[u] = --n;
+    R->Tree[R->cap + n] = u == R->tail ? INT_MAX : R->G[u];
+    u = R->Prev[u];
+  }
+  for(int i = R->cap - 1; 0 < i; i--)
+    R->Tree[i] = R->Tree[2*i] < R->Tree[2*i+1] ? R->Tree[2*i] : R->Tree[2*i+1];
+}
+#endif /* RANGE */
+
+#if defined(TOPK)
+int topK = 8; /* Values kept per group */
+
+topk makeTopk(int n)
+{
+  topk K = NULL;
+
+  K = malloc(sizeof(struct topk));
+  K->k = topK;
+  K->top = 0;
+  K->Seti = malloc(n*sizeof(int));
+  K->Gi = malloc(n*sizeof(int));
+  K->Gufi = malloc(n*sizeof(int));
+  K->C = malloc(n*sizeof(int));
+  K->L = malloc((size_t)n*K->k*sizeof(int));
+  memAdd(memTopk, sizeof(struct topk) + (4 + K->k)*(long long)n*sizeof(int));
+
+  return K;
+}
+
+void freeTopk(topk *K, int n)
+{
+  memAdd(memTopk, -(sizeof(struct topk)
+                    + (4 + (*K)->k)*(long long)n*sizeof(int)));
+  free((*K)->Seti);
+  free((*K)->Gi);
+  free((*K)->Gufi);
+  free((*K)->C);
+  free((*K)->L);
+  free(*K);
+  *K = NULL;
+}
+
+int topkFind(topk K, int p)
+{ /* Path halving */
+  while(0 <= K->Seti[p]){
+    int n = K->Seti[p];
+    if(0 <= K->Seti[n]){
+      K->Seti[p] = K->Seti[n];
+      n = K->Seti[n];
     }
+    p = n;
+  }
 
-    if(A[rp].stacki > A[rq].stacki)
-      A[rp].stacki = A[rq].stacki;
-    else
-      A[rq].stacki = A[rp].stacki;
+  return p;
+}
+
+void topkJoin(topk K, int u, int g)
+{ /* Puts the set of mark u into group g */
+  int r = topkFind(K, u);
+  int p = topkFind(K, K->Gufi[g]);
+
+  if(r != p){ /* Link by rank */
+    if(K->Seti[p] < K->Seti[r]){
+      K->Seti[r] = p;
+      r = p;
+    } else {
+      if(K->Seti[p] == K->Seti[r])
+        K->Seti[r]--;
+      K->Seti[p] = r;
+    }
+    K->Gi[r] = g;
   }
 }
+#endif /* TOPK */
 
 fastRMQ
 makeRMQ(int a /* Alloc size */
@@ -377,29 +1033,57 @@ makeRMQ(int a /* Alloc size */
   R->S = makeStack(a);
   R->H = makeHash(2*a);
   R->T = makeUF(a);
+#if defined(RANGE)
+  R->R = makeRanges(R->T->a);
+#endif
+#if defined(TOPK)
+  R->K = makeTopk(R->T->a);
+#endif
   R->pos = 1; /* 0 has no sign */
 
   return R;
 }
 
+static int
+rebuildSize(int open
+            )
+{ /* Room for growth times the open marks, but not for more marks than */
+  /* the header says are still to come */
+  long long a = (long long)growth*open;
+
+  if(a < 4) /* Same as the smallest initial size */
+    a = 4;
+  if(open + marksLeft < a)
+    a = open + marksLeft;
+  if(a <= open) /* The header was short, the next mark still needs room */
+    a = open + 1;
+
+  return a;
+}
+
 fastRMQ
-makeNewRMQ(fastRMQ old
+makeNewRMQ(fastRMQ old,
+           int a /* Alloc size */
 	   )
 {
-
-  int a = 2*old->H->n;
-
-
   fastRMQ new = makeRMQ(a);
   new->pos = old->pos;
   new->S->stubQ = old->S->stubQ;
 
-  /* Traverse old stack */
+  /* Key of an open mark of every old stack item, later its new index */
+  int *Map = malloc((old->S->stub + 1)*sizeof(int));
+  assert(NULL != Map && "Failed alloc.");
   int i = 1;
+  Map[0] = 0;
   while(i < old->S->stub){
-    old->S->M[i].idx = -1; /* Mark inactive */
+    Map[i] = -1; /* Mark inactive */
     i++;
   }
+#if defined(TOPK)
+  /* Whether an old group has open marks, later its new index */
+  int *GMap = calloc(old->K->top + 1, sizeof(int));
+  assert(NULL != GMap && "Failed alloc.");
+#endif
 
   i = 0;
   while(i < old->H->a){ /* Traverse Hash */
@@ -407,33 +1091,71 @@ makeNewRMQ(fastRMQ old
        0 < old->H->T[i].value){ /* Active entries */
       /* Put in new hash */
       insert(new->H, old->H->T[i].key, new->T->lst);
+#if defined(RANGE)
+      int x = old->H->T[i].value;
+      new->R->G[new->T->lst] = old->R->G[x];
+      new->R->Val[new->T->lst] = old->R->Val[x];
+      old->R->G[x] = new->T->lst; /* Overwrite with the new index */
+#endif
       new->T->lst++; /* For now you do not know where it is going to go in S. */
 
       int ufi = old->H->T[i].value;
+#if defined(TOPK)
+      GMap[old->K->Gi[topkFind(old->K, ufi)]] = 1; /* Keep its group */
+#endif
       ufi = Find(old->T, ufi); /* Change to root */
 
-      int stacki = old->T->L[ufi].stacki;
-      if(0 > old->S->M[stacki].idx) /* Reactivate stack entry */
-        old->S->M[stacki].idx = old->H->T[i].key;
+      int stacki = UFstacki(old->T, ufi);
+      if(0 > Map[stacki]) /* Reactivate stack entry */
+        Map[stacki] = old->H->T[i].key;
     }
     i++;
   }
 
-  /* Now compact stack S */
+#if defined(TOPK) /* Keep the groups with open marks, in order */
+  for(int g = 1; g <= old->K->top; g++)
+    if(GMap[g]){
+      int h = ++new->K->top;
+      new->K->C[h] = old->K->C[g];
+      memcpy(&new->K->L[(size_t)h*topK], &old->K->L[(size_t)g*topK],
+             topK*sizeof(int));
+      new->K->Gufi[h] = 0; /* No mark yet */
+      GMap[g] = h;
+    }
+#endif
+
+  /* The top holds the current value, keep it as the stub */
+  i = old->S->stub - 1;
+  int stubV = Sv(old->S, i+1);
+  int stubIdx = Sidx(old->S, i+1);
+  if(!old->S->stubQ && 0 > Map[i]){
+    stubV = Sv(old->S, i);
+    stubIdx = old->pos - 1;
+    new->S->stubQ = 1;
+  }
+
+  /* Now compact stack S, only written upwards */
   int j = 1; /* New Stack positions */
   i = 1;
   while(i < old->S->stub){
-    if( 0 < old->S->M[i].idx){   /*  Only active entries */
-      new->S->M[j].v = old->S->M[i].v;
-      old->S->M[i].v = j; /* Overwrite value */
+    if(0 < Map[i]){   /*  Only active entries */
+#if defined(PACKED)
+      stackRoom(new->S, j);
+#endif
+      SvHot(new->S, j) = Sv(old->S, i);
+      SidxHot(new->S, j) = Map[i];
+      Map[i] = j; /* Overwrite key */
       j++;
     }
     i++;
   }
   /* Process stub */
   new->S->stub = j;
-  new->S->M[j].v = old->S->M[i].v;
-  new->S->M[j].idx = old->S->M[i].idx;
+#if defined(PACKED)
+  stackRoom(new->S, j);
+#endif
+  SvHot(new->S, j) = stubV;
+  SidxHot(new->S, j) = stubIdx;
 
   /* Now go through the Hash again */
   j = 1;
@@ -445,26 +1167,52 @@ makeNewRMQ(fastRMQ old
       int ufi = old->H->T[i].value;
       ufi = Find(old->T, ufi); /* Change to root */
 
-      int stacki = old->T->L[ufi].stacki;
+      int stacki = UFstacki(old->T, ufi);
 
       /* Put in UFI */
-      int sidx = old->S->M[stacki].v; /* Use overwritten values */
-      new->T->L[j].stacki = sidx;
-      new->S->M[sidx].idx = old->H->T[i].key;
+      int sidx = Map[stacki]; /* Use overwritten keys */
+      UFstacki(new->T, j) = sidx;
+#if defined(STACK_UFI)
+      Sufi(new->S, sidx) = j;
+#endif
+#if defined(RANGE) /* Use overwritten indexes */
+      int x = old->H->T[i].value;
+      int p = old->R->Prev[x];
+      int n = old->R->Next[x];
+      new->R->Prev[j] = 0 == p ? 0 : old->R->G[p];
+      new->R->Next[j] = 0 == n ? 0 : old->R->G[n];
+#endif
+#if defined(TOPK) /* Into the new index of its group */
+      int g = GMap[old->K->Gi[topkFind(old->K, old->H->T[i].value)]];
+      new->K->Seti[j] = -1;
+      if(0 == new->K->Gufi[g]){
+        new->K->Gufi[g] = j;
+        new->K->Gi[j] = g;
+      } else
+        topkJoin(new->K, j, g);
+#endif
       j++;
     }
     i++;
   }
 
+#if defined(RANGE)
+  if(0 != old->R->tail)
+    new->R->tail = old->R->G[old->R->tail];
+  rangeTree(new->R, j - 1);
+#endif
+
   /* Finally go for Unions */
   i = 1;
   while(i < j){
-    int stacki = new->T->L[i].stacki;
-    int idx = new->S->M[stacki].idx;
-    int ufi = get(new->H, idx);
-    Union(new->T, i, ufi);
+    int stacki = UFstacki(new->T, i);
+    Union(new->T, i, stackSet(new, stacki));
     i++;
   }
+  free(Map);
+#if defined(TOPK)
+  free(GMap);
+#endif
 
   return new;
 }
@@ -473,6 +1221,12 @@ void freeRMQ(
              fastRMQ *R
              )
 {
+#if defined(RANGE)
+  freeRanges(&((*R)->R), (*R)->T->a);
+#endif
+#if defined(TOPK)
+  freeTopk(&((*R)->K), (*R)->T->a);
+#endif
   freeUF(&((*R)->T));
   freeHash(&((*R)->H));
   freeStack(&((*R)->S));
@@ -491,8 +1245,8 @@ printRMQ(fastRMQ F)
   int i = 0;
   while(i <= F->S->stub){
     printf(">> Idx [%d] ", i);
-    printf(">> v: %d \t", F->S->M[i].v);
-    printf("idx: %d \n", F->S->M[i].idx);
+    printf(">> v: %d \t", Sv(F->S, i));
+    printf("idx: %d \n", Sidx(F->S, i));
     i++;
   }
   printf("\n");
@@ -513,37 +1267,190 @@ printRMQ(fastRMQ F)
   i = 0;
   while(i < F->T->lst){
     printf(">> Idx [%d] ", i);
-    printf("= %d \t", F->T->L[i].seti);
-    printf("stckI: %d\n", F->T->L[i].stacki);
+    printf("= %d \t", UFseti(F->T, i));
+    printf("stckI: %d\n", UFstacki(F->T, i));
     i++;
   }
 }
 
 
+void
+contract(fastRMQ F, int b, int t)
+{ /* Merges the sets of stack items b to t into the set of b */
+  int r = Find(F->T, stackSet(F, t)); /* Survivor */
+
+  while(b < t){
+    t--;
+    r = Link(F->T, r, Find(F->T, stackSet(F, t)));
+  }
+
+  UFstacki(F->T, r) = b;
+}
+
+#if defined(TOPK)
+static int
+topkSame(topk K, int g, int h)
+{ /* Groups g and h hold the same values */
+  return K->C[g] == K->C[h]
+    && 0 == memcmp(&K->L[(size_t)g*K->k], &K->L[(size_t)h*K->k],
+                   K->C[g]*sizeof(int));
+}
+
+void
+topkValue(topk K, int v)
+{ /* Adds v to the groups it belongs to, the top ones, and merges them */
+  int b = K->top;
+
+  while(0 < b && (K->C[b] < K->k || v < K->L[(size_t)b*K->k + K->k - 1])){
+    int *L = &K->L[(size_t)b*K->k];
+    int j = K->C[b] < K->k ? K->C[b]++ : K->k - 1; /* Drops the largest */
+    while(0 < j && v < L[j-1]){
+      L[j] = L[j-1];
+      j--;
+    }
+    L[j] = v;
+    b--;
+  }
+
+  /* Groups above b changed, equal neighbours now stay equal */
+  int t = b; /* Last group kept */
+  for(int g = b+1; g <= K->top; g++){
+    if(0 < t && topkSame(K, t, g)){
+      topkJoin(K, K->Gufi[g], t);
+      continue;
+    }
+    t++;
+    if(t < g){ /* Move down */
+      K->C[t] = K->C[g];
+      memcpy(&K->L[(size_t)t*K->k], &K->L[(size_t)g*K->k],
+             K->C[g]*sizeof(int));
+      K->Gufi[t] = K->Gufi[g];
+      K->Gi[topkFind(K, K->Gufi[t])] = t;
+    }
+  }
+  K->top = t;
+}
+
+void
+topkMark(fastRMQ F, int u)
+{ /* Mark u starts with the last value, or joins a group with only it */
+  topk K = F->K;
+  int v = Sv(F->S, F->S->stub - 1); /* The last value */
+  int g = K->top;
+
+  K->Seti[u] = -1;
+  if(0 < g && 1 == K->C[g] && v == K->L[(size_t)g*K->k]){
+    topkJoin(K, u, g);
+    return;
+  }
+
+  g = ++K->top;
+  K->C[g] = 1;
+  K->L[(size_t)g*K->k] = v;
+  K->Gufi[g] = u;
+  K->Gi[u] = g;
+}
+
+int *
+topkCmd(fastRMQ F, int p, int *k)
+{ /* The *k smallest values since the mark at position p, fewer when */
+  /* there are not as many */
+  topk K = F->K;
+  int g = K->Gi[topkFind(K, get(F->H, p))];
+
+  assert(*k <= K->k && "Top k query above -k.");
+  if(K->C[g] < *k)
+    *k = K->C[g];
+
+  return &K->L[(size_t)g*K->k];
+}
+#endif /* TOPK */
+
 void
 process(fastRMQ F, int v)
 { /* Read int c from the input */
   /* printf("Process %d\n", v); */
 
-  stackItem sti = Top(F->S);
+  int sti = Top(F->S);
 
-  if(sti->v <= v){ /* Element is larger put in new space */
+  if(Sv(F->S, sti) <= v){ /* Element is larger put in new space */
     sti = getStub(F->S); /* Puts an empty item into the stack */
-    sti->v = v;
-    sti->idx = F->pos;
+    SvHot(F->S, sti) = v;
+    SidxHot(F->S, sti) = F->pos;
   } else { /* Element is smaller contract stack */
-    int ufi = get(F->H, sti->idx); /* UFindex */
-    stackItem ssti = STop(F->S);
-    while(ssti->v >= v){
-      Union(F->T, get(F->H, ssti->idx), ufi);
-      Pop(F->S); /* Remove top from stack */
-      ssti = STop(F->S);
-    }
-    Top(F->S)->v = v;
+#if defined(PACKED)
+    int k = stackCut(F->S, STop(F->S), v); /* Stays in stack */
+#else
+    int k = cut(SvBase(F->S), SSTRIDE, STop(F->S), v); /* Stays in stack */
+#endif
+    STAT(histRecord(&popH, sti - k - 1);)
+    if(k+1 < sti)
+      contract(F, k+1, sti);
+    PopTo(F->S, k+1);
+#if defined(PACKED)
+    stackHot(F->S, k+1);
+#endif
+    SvHot(F->S, k+1) = v;
   }
+#if defined(TOPK)
+  topkValue(F->K, v);
+#endif
   F->pos++; /* Increment position */
 }
 
+#if defined(RANGE)
+void
+rangeMark(fastRMQ F, int u)
+{ /* Appends mark u, the gap of the previous mark is now closed */
+  ranges R = F->R;
+  int t = R->tail;
+
+  R->Val[u] = Sv(F->S, F->S->stub - 1); /* The last value */
+  R->Prev[u] = t;
+  R->Next[u] = 0;
+  R->Rank[u] = R->n++;
+  if(0 != t){
+    R->Next[t] = u;
+    R->G[t] = Sv(F->S, UFstacki(F->T, Find(F->T, t)));
+    rangeSet(R, R->Rank[t], R->G[t]);
+  }
+  R->tail = u;
+}
+
+void
+rangeClose(fastRMQ F, int p)
+{ /* Removes the mark at position p, its gap joins the previous one */
+  ranges R = F->R;
+  int u = get(F->H, p);
+  int a = R->Prev[u];
+  int b = R->Next[u];
+
+  if(0 != a){
+    R->Next[a] = b;
+    if(0 != b && R->G[u] < R->G[a]){
+      R->G[a] = R->G[u];
+      rangeSet(R, R->Rank[a], R->G[a]);
+    }
+  }
+  rangeSet(R, R->Rank[u], INT_MAX); /* Its gap is in the one of a */
+  if(0 != b)
+    R->Prev[b] = a;
+  else
+    R->tail = a;
+}
+
+int
+rangeCmd(fastRMQ F, int p, int q)
+{ /* Minimum between the marks at positions p <= q, in O(log marks) */
+  ranges R = F->R;
+  int u = get(F->H, p);
+  int w = get(F->H, q);
+  int v = rangeMin(R, R->Rank[u], R->Rank[w]); /* The gaps in between */
+
+  return R->Val[w] < v ? R->Val[w] : v;
+}
+#endif /* RANGE */
+
 void
 markCmd(fastRMQ *PF)
 {
@@ -554,7 +1461,14 @@ markCmd(fastRMQ *PF)
     /* printf("Before RMQ transfer\n"); */
     /* printRMQ(F); */
 
-    fastRMQ new = makeNewRMQ(F);
+    long long t = nsNow();
+    STAT(statsOff = 1;) /* Not the hot path */
+    fastRMQ new = makeNewRMQ(F, rebuildSize(F->H->n));
+    STAT(statsOff = 0;)
+    rebuilds++;
+    t = nsNow() - t;
+    rebuildNs += t;
+    STAT(histRecord(&rebuildH, t);)
     freeRMQ(PF);
     *PF = new;
     F = *PF;
@@ -567,15 +1481,28 @@ markCmd(fastRMQ *PF)
   insert(F->H, F->pos-1, F->T->lst);
 
  /* Add to UF */
-  F->T->L[F->T->lst].stacki = F->S->stub;
+  UFstacki(F->T, F->T->lst) = F->S->stub;
 
   /* Add to Stack, if needed */
-  if(wasStubQ(F->S)) /* Last command was stub */
+  if(wasStubQ(F->S)){ /* Last command was stub */
+#if defined(STACK_UFI)
+    Sufi(F->S, F->S->stub) = F->T->lst;
+#endif
     Push(F->S); /* Put stub on stack */
-  else
-    Union(F->T, F->T->lst, get(F->H, Top(F->S)->idx));
+  } else
+    Union(F->T, F->T->lst, stackSet(F, Top(F->S)));
+
+#if defined(RANGE)
+  rangeMark(F, F->T->lst);
+#endif
+#if defined(TOPK)
+  topkMark(F, F->T->lst);
+#endif
 
   F->T->lst++; /* Finish UF add */
+  marksLeft--;
+  if(peakOpen < F->H->n)
+    peakOpen = F->H->n;
 }
 
 int
@@ -585,101 +1512,396 @@ queryCmd(fastRMQ F, int p)
 
   int ufi = get(F->H, p); /* UFindex */
   int rootUFI = Find(F->T, ufi);
-  int Sidx = F->T->L[rootUFI].stacki; /* Stack Index */
+  int si = UFstacki(F->T, rootUFI); /* Stack Index */
+
+  return Sv(F->S, si);
+}
+
+#if defined(PIPELINE)
+/* The hash slot, union find item and stack item of a query depend on each */
+/* other, so on large structures every query waits for several misses. The */
+/* pipeline reads the commands still in the buffer, prefetches the hash */
+/* slots LOOKH integers ahead and, once those are loaded, the union find */
+/* items LOOKU integers ahead. Marks use the position their key will have. */
 
-  return F->S->M[Sidx].v;
+#define LOOKH 64 /* Integers ahead, hash slots */
+#define LOOKU 32 /* Integers ahead, union find items */
+
+struct ahead{
+  int gen; /* Buffer read of a */
+  int a; /* Next command to look at, in iBuffer */
+  int pos; /* F->pos when that command runs */
+};
+
+struct ahead hashA = {-1, 0, 0};
+struct ahead ufA = {-1, 0, 0};
+
+static sureInline(void) prefetchKey(fastRMQ F,
+                                    int key,
+                                    int uf /* Prefetch the union find item */
+                                    )
+{
+  hashItem h = &F->H->T[hashFun(key, F->H->a)];
+
+  if(!uf)
+    __builtin_prefetch(h);
+  else if(h->key == key) /* Only the first probe, no statistics */
+    __builtin_prefetch(&UFseti(F->T, abs(h->value)));
+}
+
+static void
+lookAhead(fastRMQ F,
+          struct ahead *A,
+          int dist, /* Integers ahead of the current command */
+          int uf
+          )
+{ /* Prefetches for the commands in the buffer up to dist ahead */
+  int c = bufferIdx - 1; /* Current command */
+  int end = bufferIdx + load/4; /* Integers in the buffer */
+  int *C;
+
+  if(A->gen != bufferGen || A->a < c){ /* Restart at the current command */
+    A->gen = bufferGen;
+    A->a = c;
+    A->pos = F->pos;
+  }
+
+  while(A->a < c + dist && A->a < end){
+    C = &iBuffer[A->a];
+    switch(C[0]){
+    case value:
+      A->pos++;
+      A->a += 2;
+      break;
+    case mark:
+      if(!uf)
+        __builtin_prefetch(&F->H->T[hashFun(A->pos-1, F->H->a)]);
+      A->a += 1;
+      break;
+    case query: case closeQ:
+      if(end <= A->a + 1)
+        return;
+      prefetchKey(F, C[1], uf);
+      A->a += 2;
+      break;
+    case rangeQ:
+      if(end <= A->a + 2)
+        return;
+      prefetchKey(F, C[1], uf);
+      prefetchKey(F, C[2], uf);
+      A->a += 3;
+      break;
+    case topkQ:
+      if(end <= A->a + 2)
+        return;
+      prefetchKey(F, C[1], uf);
+      A->a += 3;
+      break;
+    case batchQ: /* batchCmd prefetches its own keys */
+      if(end <= A->a + 1)
+        return;
+      A->a += 2 + C[1];
+      break;
+    default:
+      return;
+    }
+  }
+}
+#endif /* PIPELINE */
+
+static int
+batchCmp(const void *a,
+         const void *b
+         )
+{
+  unsigned long long x = *(const unsigned long long *)a;
+  unsigned long long y = *(const unsigned long long *)b;
+
+  return (x > y) - (x < y);
+}
+
+void
+batchCmd(fastRMQ F, int k, int *P, int *Out)
+{ /* Out[t] is queryCmd(F, P[t]), for t < k */
+  unsigned long long U[BATCH]; /* Set index over batch offset */
+  int I[BATCH]; /* Hash slots, then stack indexes */
+  int b, t, n;
+  int u;
+  int last; /* Previous set index */
+  int si; /* Stack index of last */
+
+  for(b = 0; b < k; b += BATCH){
+    n = k - b < BATCH ? k - b : BATCH;
+
+    for(t = 0; t < n; t++){ /* Start every hash load before probing */
+      I[t] = hashFun(P[b+t], F->H->a);
+      __builtin_prefetch(&F->H->T[I[t]]);
+    }
+
+    for(t = 0; t < n; t++){
+      u = abs(F->H->T[probe(F->H, P[b+t], I[t])].value);
+      __builtin_prefetch(&UFseti(F->T, u));
+      U[t] = (unsigned long long)u << 32 | t;
+    }
+
+    /* Sets in creation order, repeated marks become adjacent */
+    qsort(U, n, sizeof(U[0]), batchCmp);
+
+    last = 0; /* Position 0 is never a set */
+    si = 0;
+    for(t = 0; t < n; t++){
+      u = U[t] >> 32;
+      if(u != last){
+        si = UFstacki(F->T, Find(F->T, u));
+        SvPrefetch(F->S, si);
+        last = u;
+      }
+      I[U[t] & 0xffffffff] = si;
+    }
+
+    for(t = 0; t < n; t++)
+      Out[b+t] = Sv(F->S, I[t]);
+  }
 }
 
 void
 RMQAssert(fastRMQ F)
-{
+{ /* Checks the invariants, linear in the size of the structures */
   assert(2*F->H->n <= F->H->a && "Hash overflow");
   assert(F->T->lst <= F->T->a && "UF overflow");
-  assert(F->S->stub <= F->S->a && "UF overflow");
+  assert(F->S->stub < F->S->a && "Stack overflow");
 
   int i;
-  int j;
+  int n = 0; /* Open marks */
 
-  i = 1;
-  while(i < F->S->stub){
-    if(contains(F->H, F->S->M[i].idx)){
-      j = i+1;
-      while(j < F->S->stub){
-	if(contains(F->H, F->S->M[j].idx)){
-	  assert(Find(F->T, get(F->H, F->S->M[i].idx))
-		 != Find(F->T, get(F->H, F->S->M[j].idx))
-		 && "Mixed sets in stack");
-	}
-	j++;
-      }
+  i = 0;
+  while(i < F->H->a){ /* Every mark is in a set of the stack */
+    if(0 != F->H->T[i].key){
+      int si = UFstacki(F->T, Find(F->T, abs(F->H->T[i].value)));
+      assert(0 < si && si < F->S->stub && "Mark outside stack");
+      (void)si;
+      if(0 < F->H->T[i].value)
+        n++;
     }
     i++;
   }
+  assert(n == F->H->n && "Wrong number of open marks");
 
+  /* A set points at a single stack item, so no sets are mixed */
   i = 1;
   while(i < F->S->stub){
-    assert(i == F->T->L[Find(F->T, get(F->H, F->S->M[i].idx))].stacki
-           && "Failed Stack index" );
-    i++;
-  }
-
-  i = 1;
-  while(i+1 < F->S->stub){
-    assert(F->S->M[i].v < F->S->M[i+1].v
-           && "Failed Stack index" );
+    assert(contains(F->H, Sidx(F->S, i)) && "Stack item without mark");
+    int r = Find(F->T, get(F->H, Sidx(F->S, i)));
+    assert(i == UFstacki(F->T, r) && "Failed Stack index");
+#if defined(STACK_UFI)
+    assert(r == Find(F->T, Sufi(F->S, i)) && "Failed stack set");
+#endif
+    assert(Sv(F->S, i-1) <= Sv(F->S, i) && "Failed Stack order");
+    (void)r;
     i++;
   }
 }
 
-
 int
 main(int argc, char** argv){
 
   int q;
-
+  int a = 4; /* Initial capacity, expected open marks */
+  int stats = 0; /* Print statistics */
+  int opt;
+
+  while(-1 != (opt = getopt(argc, argv, "so:g:t:i:k:"))){
+    switch(opt){
+    case 's':
+      stats = 1;
+      break;
+    case 'o':
+      a = atoi(optarg);
+      break;
+    case 'g':
+      growth = atoi(optarg);
+      break;
+#if defined(SPILL)
+    case 't':
+      spillDir = optarg;
+      break;
+#endif
+    case 'i':
+      ringsAttach(optarg);
+      break;
+#if defined(TOPK)
+    case 'k':
+      topK = atoi(optarg);
+      break;
+#endif
+    default:
+      fprintf(stderr, "Usage: %s [-s] [-o open marks] [-g growth]"
+              " [-t spill directory] [-i ring] [-k top k] < file\n",
+              argv[0]);
+      return 1;
+    }
+  }
+  assert(1 < growth && "Growth must exceed 1.");
+#if defined(TOPK)
+  assert(0 < topK && "Top k must be positive.");
+#endif
+
+#if defined(URING)
+  if(NULL == inRing)
+    uringOpen();
+#endif
   q = getInt();
-
-  fastRMQ F = makeRMQ(4);
+  marksLeft = q;
+  if(q < a) /* No more marks than the header says */
+    a = q;
+  if(a < 4)
+    a = 4;
+  selectCut();
+  STAT(stats = 1;)
+  if(stats)
+    memTLBOpen();
+
+  fastRMQ F = makeRMQ(a);
   int c; /* Character being read. */
   int idx;
-
-  /* RMQAssert(F); */
+  int jdx; /* Second index of ranges */
+  int k; /* Batch size */
+  int ba = 0; /* Alloced batch positions */
+  int *BP = NULL; /* Batch positions */
+  int *BO = NULL; /* Batch answers */
+#if defined(TOPK)
+  int *KL; /* Smallest values of a top k query */
+#endif
+  STAT(long long t;)
+  STAT(signal(SIGUSR1, statsSignal);)
+
+#if defined(RMQCHECK)
+  RMQAssert(F);
+#endif
 
   c = getInt();
   while(0 <= load){ /* There is file to read */
 
-    assert(F->T->L[0].seti == -1 && "touched first set");
+    assert(UFseti(F->T, 0) == -1 && "touched first set");
+#if defined(PIPELINE)
+    lookAhead(F, &hashA, LOOKH, 0);
+    lookAhead(F, &ufA, LOOKU, 1);
+#endif
     /* printRMQ(F); */
+    STAT(t = nsNow();)
     switch(c){
     case value:
       process(F, getInt());
+      STAT(histRecord(&cmdH[0], nsNow() - t);)
       break;
 
     case mark:
       markCmd(&F);
+      STAT(histRecord(&cmdH[1], nsNow() - t);)
       break;
 
     case query: case closeQ: /* Queries */
       idx = getInt();
       idx--;
       vout = queryCmd(F, 1+idx);
+      if(closeQ == c){ /* Close marking */
+#if defined(RANGE)
+        rangeClose(F, 1+idx);
+#endif
+        markDelete(F->H, 1+idx);
+      }
+      STAT(histRecord(&cmdH[c - value], nsNow() - t);)
 
-      printf("%d ", 1+idx);
-      printf("%d ", F->pos-2);
-      printf("%d\n", vout);
+      answer(1+idx, F->pos-2, vout);
+      break;
 
-      if(closeQ == c) /* Close marking */
-        markDelete(F->H, 1+idx);
+    case rangeQ: /* Between two marks */
+      idx = getInt();
+      jdx = getInt();
+      if(jdx < idx){
+        int swap = idx;
+        idx = jdx;
+        jdx = swap;
+      }
+#if defined(RANGE)
+      vout = rangeCmd(F, idx, jdx);
+      STAT(histRecord(&cmdH[c - value], nsNow() - t);)
+
+      answer(idx, jdx, vout);
+#else
+      fprintf(stderr, "Range queries need RANGE.\n");
+      return 1;
+#endif
+      break;
+    case topkQ: /* Smallest values since a mark */
+      idx = getInt();
+      k = getInt();
+#if defined(TOPK)
+      KL = topkCmd(F, idx, &k);
+      STAT(histRecord(&cmdH[c - value], nsNow() - t);)
+
+      for(jdx = 0; jdx < k; jdx++){
+        vout = KL[jdx];
+        answer(idx, F->pos-2, vout);
+      }
+#else
+      fprintf(stderr, "Top k queries need TOPK.\n");
+      return 1;
+#endif
+      break;
+    case batchQ: /* Many queries at once */
+      k = getInt();
+      if(ba < k){
+        ba = k;
+        BP = realloc(BP, ba*sizeof(int));
+        BO = realloc(BO, ba*sizeof(int));
+        assert(NULL != BP && NULL != BO && "Failed alloc.");
+      }
+      for(idx = 0; idx < k; idx++)
+        BP[idx] = getInt();
+      batchCmd(F, k, BP, BO);
+      STAT(histRecord(&cmdH[c - value], nsNow() - t);)
+
+      for(idx = 0; idx < k; idx++){
+        vout = BO[idx];
+        answer(BP[idx], F->pos-2, vout);
+      }
       break;
     default:
       break;
     }
-    /* RMQAssert(F); */
+#if defined(RMQCHECK)
+    RMQAssert(F);
+#endif
+    STAT(if(statsQ){ /* SIGUSR1 */
+        statsQ = 0;
+        statsDump();
+        memReport(F->H->n, peakOpen);
+      })
     c = getInt();
   }
 
   /* printRMQ(F); */
 
+#if defined(STATS)
+  statsDump();
+  memReport(F->H->n, peakOpen);
+#else
+  if(stats){
+    fprintf(stderr, "rebuilds %d\n", rebuilds);
+    fprintf(stderr, "rebuild ms %.1f\n", rebuildNs/1e6);
+    memReport(F->H->n, peakOpen);
+  }
+#endif
+
+  if(NULL != inRing)
+    ringsDetach();
+#if defined(URING)
+  else
+    uringClose();
+#endif
+  free(BP);
+  free(BO);
   freeRMQ(&F);
 
   return 0;
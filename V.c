@@ -24,9 +24,16 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <limits.h>
 #include <assert.h>
 #include "commands.h"
+#include "scan.h"
+#include "mem.h"
+#if defined(URING)
+#include "uring.h"
+#endif
+#include "ring.h"
 
 #define sureInline(X) __inline X __attribute__((__gnu_inline__, __always_inline__, __artificial__))
 
@@ -41,11 +48,22 @@ int bufferIdx = 0;
 static sureInline(int) getInt(void)
 {
   if(0 == load){
-    int rSize = read(0, &(buffer[0]), BUFSIZ);
+    int rSize;
+    if(NULL != inRing)
+      rSize = ringFill(&iBuffer); /* Read in place */
+#if defined(URING)
+    else if(uringIn)
+      rSize = uringFill(&iBuffer); /* Read ahead in place */
+#endif
+    else {
+      rSize = read(0, &(buffer[0]), BUFSIZ);
+      iBuffer = (int*)&(buffer[0]);
+    }
+    if(0 == rSize)
+      iBuffer = (int*)&(buffer[0]);
     assert(0 == (rSize % 4) && "Broken integer read.");
     load = rSize;
 
-    iBuffer = (int*)&(buffer[0]);
     bufferIdx = 0;
     if(0 == load) /* Prepare end of file */
       iBuffer[bufferIdx] = EOF;
@@ -100,8 +118,28 @@ stack S; /* Algorithms stack */
 /* Negative numbers are ranks. Positive numbers are pointers */
 typedef int *UF;
 
+#if defined(RANGE)
+struct ranges{ /* Open marks in position order, indexed like T */
+  int tail; /* Last open mark, -1 when there is none */
+  int cap; /* Sets of T */
+  int n; /* Ranks given */
+  int *G; /* Minimum from this mark to the next one, both included */
+  int *Val; /* Value at the mark */
+  int *Prev; /* Previous open mark, -1 for none */
+  int *Next; /* Next open mark, -1 for none */
+  int *Rank; /* Position order of a mark */
+  int *Tree; /* Segment tree of the minima G, leaves from cap by rank */
+};
+
+typedef struct ranges *ranges;
+
+ranges R; /* Range minima between open marks */
+#endif /* RANGE */
+
 UF T; /* Array for UF data structure */
 int *T2S; /* Map from UF data structure to stack position */
+int cap; /* Sets that fit in T and T2S */
+int rebuilds = 0; /* Number of calls to compact */
 
 void Push(stack S)
 { /* Pushes element into the stack */
@@ -120,11 +158,22 @@ makeHash(int n
 
   h = malloc(sizeof(struct hash));
   h->a = primes[i];
-  h->T = calloc(h->a, sizeof(struct hashItem));
+  h->T = cacheAlloc(h->a*sizeof(struct hashItem));
+  memset(h->T, 0, h->a*sizeof(struct hashItem));
+  memAdd(memHash, sizeof(struct hash) + h->a*sizeof(struct hashItem));
 
   return h;
 }
 
+void
+freeHash(hash h
+         )
+{
+  memAdd(memHash, -(sizeof(struct hash) + h->a*sizeof(struct hashItem)));
+  cacheFree(h->T, h->a*sizeof(struct hashItem));
+  free(h);
+}
+
 static unsigned int
 hashFun(int key,
         int M /* Use size as modulus */
@@ -219,7 +268,8 @@ stack makeStack(int n)
   S->a = n+2;
   S->top = 0;
   S->stub = 0; /* means false */
-  S->M = malloc(S->a*sizeof(struct stackItem));
+  S->M = cacheAlloc(S->a*sizeof(struct stackItem));
+  memAdd(memStack, sizeof(struct stack) + S->a*sizeof(struct stackItem));
   S->M[0].v = INT_MIN;
   Push(S);
 
@@ -228,7 +278,8 @@ stack makeStack(int n)
 
 void freeStack(stack S)
 {
-  free(S->M);
+  memAdd(memStack, -(sizeof(struct stack) + S->a*sizeof(struct stackItem)));
+  cacheFree(S->M, S->a*sizeof(struct stackItem));
   free(S);
 }
 
@@ -266,12 +317,20 @@ Pop(stack S)
   S->top--;
 }
 
+void
+PopTo(stack S, int t)
+{ /* Pops elements until t is the top */
+  S->stub = 0; /* means false */
+  S->top = t + 1;
+}
+
 UF makeUF(int n)
 {
   UF A = NULL;
   int i; /* Counter */
 
-  A = malloc(n*sizeof(int));
+  A = cacheAlloc(n*sizeof(int));
+  memAdd(memUF, n*sizeof(int));
   i = 0;
   while(i < n){
     A[i] = -1; /* Initial rank */
@@ -283,60 +342,361 @@ UF makeUF(int n)
 
 int Find(UF A, int q)
 {
-  static int LA[35]; /* Iterative find */
-  int i;
   int p = q;
 
-  i = 0;
-  while(0 <= A[p]){
-    LA[i] = p;
-    i++;
+#if defined(FIND_COMPRESS)
+  while(0 <= A[p])
     p = A[p]; /* Move up */
+
+  while(q != p){ /* Second pass, point the path to the root */
+    int n = A[q];
+    A[q] = p;
+    q = n;
+  }
+#elif defined(FIND_SPLIT)
+  while(0 <= A[p]){ /* Every node points to its grandparent */
+    int n = A[p];
+    if(0 <= A[n])
+      A[p] = A[n];
+    p = n; /* Move up */
   }
+#else /* Path halving */
+  while(0 <= A[p]){ /* Every other node points to its grandparent */
+    int n = A[p];
+    if(0 <= A[n]){
+      A[p] = A[n];
+      n = A[n];
+    }
+    p = n; /* Move up */
+  }
+#endif
 
-  assert(i < 35 && "Hit limit");
+  return p;
+}
 
-  while(i > 0){
-    i--;
-    A[LA[i]] = p;
+int Link(UF A, int r, int p)
+{ /* Links roots r and p by rank, returns the new root */
+  if(A[p] < A[r]){
+    A[r] = p;
+    return p;
   }
 
-  return p;
+  if(A[p] == A[r])
+    A[r]--;
+  A[p] = r;
+
+  return r;
 }
 
 void Union(UF A, int p, int q)
 {
   /* printf("Uniting %d %d\n", p, q); */
 
-  int rp = Find(A, p);
-  int rq = Find(A, q);
+  Link(A, Find(A, q), Find(A, p));
+}
+
+#if defined(RANGE)
+ranges makeRanges(int n)
+{
+  ranges R = NULL;
+
+  R = malloc(sizeof(struct ranges));
+  R->tail = -1;
+  R->cap = n;
+  R->n = 0;
+  R->G = malloc(n*sizeof(int));
+  R->Val = malloc(n*sizeof(int));
+  R->Prev = malloc(n*sizeof(int));
+  R->Next = malloc(n*sizeof(int));
+  R->Rank = malloc(n*sizeof(int));
+  R->Tree = malloc(2*n*sizeof(int));
+  assert(NULL != R->Tree && "Failed alloc.");
+  for(int i = 0; i < 2*n; i++)
+    R->Tree[i] = INT_MAX; /* No gap */
+  memAdd(memRange, sizeof(struct ranges) + 7*n*sizeof(int));
+
+  return R;
+}
+
+void freeRanges(ranges R)
+{
+  memAdd(memRange, -(sizeof(struct ranges) + 7*R->cap*sizeof(int)));
+  free(R->G);
+  free(R->Val);
+  free(R->Prev);
+  free(R->Next);
+  free(R->Rank);
+  free(R->Tree);
+  free(R);
+}
+
+static void
+rangeSet(ranges R, int r, int v)
+{ /* Leaf of rank r is v */
+  r += R->cap;
+  R->Tree[r] = v;
+  for(r /= 2; 0 < r; r /= 2)
+    R->Tree[r] = R->Tree[2*r] < R->Tree[2*r+1] ? R->Tree[2*r] : R->Tree[2*r+1];
+}
+
+static int
+rangeMin(ranges R, int a, int b)
+{ /* Minimum of the leaves of ranks a to b-1 */
+  int v = INT_MAX;
+
+  for(a += R->cap, b += R->cap; a < b; a /= 2, b /= 2){
+    if(a & 1){
+      if(R->Tree[a] < v)
+        v = R->Tree[a];
+      a++;
+    }
+    if(b & 1){
+      b--;
+      if(R->Tree[b] < v)
+        v = R->Tree[b];
+    }
+  }
+
+  return v;
+}
+
+static void
+rangeTree(ranges R, int n)
+{ /* Ranks and tree of the n open marks after a compaction */
+  int u = R->tail;
+
+  R->n = n;
+  while(-1 != u){ /* Backwards in position order */
+    R->Rank[u] = --n;
+    R->Tree[R->cap + n] = u == R->tail ? INT_MAX : R->G[u];
+    u = R->Prev[u];
+  }
+  for(int i = R->cap - 1; 0 < i; i--)
+    R->Tree[i] = R->Tree[2*i] < R->Tree[2*i+1] ? R->Tree[2*i] : R->Tree[2*i+1];
+}
+
+void
+rangeMark(int u)
+{ /* Appends mark u, the gap of the previous mark is now closed */
+  int t = R->tail;
+
+  R->Val[u] = S->M[T2S[Find(T, u)]].v; /* The last value */
+  R->Prev[u] = t;
+  R->Next[u] = -1;
+  R->Rank[u] = R->n++;
+  if(-1 != t){
+    R->Next[t] = u;
+    R->G[t] = S->M[T2S[Find(T, t)]].v;
+    rangeSet(R, R->Rank[t], R->G[t]);
+  }
+  R->tail = u;
+}
+
+void
+rangeClose(int u)
+{ /* Removes mark u, its gap joins the previous one */
+  int a = R->Prev[u];
+  int b = R->Next[u];
+
+  if(-1 != a){
+    R->Next[a] = b;
+    if(-1 != b && R->G[u] < R->G[a]){
+      R->G[a] = R->G[u];
+      rangeSet(R, R->Rank[a], R->G[a]);
+    }
+  }
+  rangeSet(R, R->Rank[u], INT_MAX); /* Its gap is in the one of a */
+  if(-1 != b)
+    R->Prev[b] = a;
+  else
+    R->tail = a;
+}
+
+int
+rangeCmd(int u, int w)
+{ /* Minimum between the open marks u and w, u first, in O(log marks) */
+  int v = rangeMin(R, R->Rank[u], R->Rank[w]); /* The gaps in between */
 
-  if(A[rp] < A[rq])
-    A[rq] = rp;
-  else {
-    if(A[rp] == A[rq])
-      A[rq]--;
-    A[rp] = rq;
+  return R->Val[w] < v ? R->Val[w] : v;
+}
+
+static ranges
+rangeCompact(int a, /* New capacity */
+             int *New, /* Old to new set indexes */
+             int open
+             )
+{ /* Ranges of the open marks with the sets given by New */
+  ranges nR = makeRanges(a);
+  int u;
+  int n;
+
+  nR->tail = -1 == R->tail ? -1 : New[R->tail];
+  for(u = R->tail; -1 != u; u = R->Prev[u]){
+    n = New[u];
+    nR->G[n] = R->G[u];
+    nR->Val[n] = R->Val[u];
+    nR->Prev[n] = -1 == R->Prev[u] ? -1 : New[R->Prev[u]];
+    nR->Next[n] = -1 == R->Next[u] ? -1 : New[R->Next[u]];
   }
+  rangeTree(nR, open);
+
+  return nR;
+}
+#endif /* RANGE */
+
+void
+contract(stack S, int b, int t)
+{ /* Merges the sets of stack items b to t into the set of b */
+  int r = Find(T, S->M[t].ufi); /* Survivor */
+
+  while(b < t){
+    t--;
+    r = Link(T, r, Find(T, S->M[t].ufi));
+  }
+
+  T2S[r] = b;
+}
+
+static int
+compact(int open /* Number of open marks */
+        )
+{ /* Rebuilds S, H, T and T2S for the open marks only, returns their */
+  /* number, which is also the next set index */
+  int a = 2*open; /* New capacity */
+  if(a < 4)
+    a = 4;
+
+  stack nS = makeStack(a);
+  hash nH = makeHash(2*a);
+  UF nT = makeUF(a);
+  int *nT2S = cacheAlloc(a*sizeof(int));
+  memAdd(memT2S, a*sizeof(int));
+  int *Map = malloc((S->top + 1)*sizeof(int)); /* Old to new stack */
+#if defined(RANGE)
+  int *New = malloc(cap*sizeof(int)); /* Old to new sets */
+#endif
+  int i, j, k;
+
+  for(i = 0; i <= S->top; i++)
+    Map[i] = -1;
+  for(i = 0; i < H->a; i++) /* Stack items of open marks */
+    if(0 != H->T[i].key)
+      Map[T2S[Find(T, H->T[i].value)]] = 0;
+
+  j = 1;
+  for(i = 1; i < S->top; i++)
+    if(0 == Map[i]){
+      Map[i] = j;
+      nS->M[j].v = S->M[i].v;
+      nS->M[j].ufi = -1; /* No set yet */
+      j++;
+    }
+  nS->top = j;
+
+  /* The top holds the current value, without marks it becomes the stub */
+  nS->stub = S->stub;
+  if(S->stub)
+    nS->M[j].v = S->M[S->top].v;
+  else if(1 < S->top && -1 == Map[S->top-1]){
+    nS->M[j].v = S->M[S->top-1].v;
+    nS->stub = 1;
+  }
+
+  k = 0;
+  for(i = 0; i < H->a; i++)
+    if(0 != H->T[i].key){ /* One set per stack item */
+      j = Map[T2S[Find(T, H->T[i].value)]];
+      if(-1 == nS->M[j].ufi){
+        nS->M[j].ufi = k;
+        nT2S[k] = j;
+      } else {
+        nT[k] = nS->M[j].ufi;
+        nT[nS->M[j].ufi] = -2; /* Rank of a root with children */
+      }
+      insert(nH, H->T[i].key-1, k);
+#if defined(RANGE)
+      New[H->T[i].value] = k;
+#endif
+      k++;
+    }
+
+  free(Map);
+#if defined(RANGE)
+  ranges nR = rangeCompact(a, New, k);
+  free(New);
+  freeRanges(R);
+  R = nR;
+#endif
+  freeStack(S);
+  freeHash(H);
+  memAdd(memUF, -cap*sizeof(int));
+  cacheFree(T, cap*sizeof(int));
+  memAdd(memT2S, -cap*sizeof(int));
+  cacheFree(T2S, cap*sizeof(int));
+
+  S = nS;
+  H = nH;
+  T = nT;
+  T2S = nT2S;
+  cap = a;
+  rebuilds++;
+
+  return k;
 }
 
 int
 main(int argc, char** argv){
 
   int q;
+  int stats = 0; /* Print statistics */
+  int reclaim = 0; /* Compact when T fills, instead of sizing by q */
+  int opt;
+
+  while(-1 != (opt = getopt(argc, argv, "sri:"))){
+    switch(opt){
+    case 's':
+      stats = 1;
+      break;
+    case 'r':
+      reclaim = 1;
+      break;
+    case 'i':
+      ringsAttach(optarg);
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-s] [-r] [-i ring] < file\n", argv[0]);
+      return 1;
+    }
+  }
 
+#if defined(URING)
+  if(NULL == inRing)
+    uringOpen();
+#endif
   q = getInt();
-
-  S = makeStack(q);
-  H = makeHash(q);
-  T = makeUF(q);
-  T2S = malloc(q*sizeof(int));
+  selectCut();
+  if(stats)
+    memTLBOpen();
+
+  cap = reclaim ? 4 : q;
+  S = makeStack(cap);
+  H = makeHash(reclaim ? 2*cap : cap);
+  T = makeUF(cap);
+  T2S = cacheAlloc(cap*sizeof(int));
+  memAdd(memT2S, cap*sizeof(int));
+#if defined(RANGE)
+  R = makeRanges(cap);
+#endif
 
   int ufc = 0; /* Counter for the UF structure */
+  int open = 0; /* Number of open marks */
+  int peakOpen = 0; /* Largest number of open marks */
   int pos; /* The position in the array */
   int c; /* Character being read. */
   int v; /* A value for the array */
   int qi; /* Query index. */
+  int qj; /* Second index of ranges */
+  int k; /* Queries left in a batch */
   stackItem sti; /* Stack item */
 
   pos = -1;
@@ -351,26 +711,22 @@ main(int argc, char** argv){
         sti = getStub(S); /* Puts an empty item into the stack */
         sti->v = v;
       } else { /* Element is smaller contract stack */
-        int pufi = -1; /* Previous UFi */
-        if(sti->v > v){
-          sti->v = v;
-          pufi = sti->ufi;
-        }
-        sti = STop(S); /* Second to top */
-        while(sti->v >= v){
-          sti->v = v;
-          Union(T, sti->ufi, pufi);
-          T2S[Find(T, sti->ufi)] = S->top-2;
-          pufi = sti->ufi;
-          Pop(S); /* Remove top from stack */
-          sti = STop(S);
-        }
+        int k = cut(&(S->M[0].v), 2, S->top-2, v); /* Stays in stack */
+        if(k+1 < S->top-1)
+          contract(S, k+1, S->top-1);
+        PopTo(S, k+1);
+        S->M[k+1].v = v;
       }
 
       pos++; /* Increment position */
       break;
 
     case mark:
+      if(ufc == cap){ /* Only with reclaim, otherwise q is enough */
+        assert(reclaim && "More marks than the header says.");
+        ufc = compact(open);
+      }
+
       /* ufc Is the index for the new set */
       insert(H, pos, ufc); /* Insert to hash */
 
@@ -383,7 +739,13 @@ main(int argc, char** argv){
       }
 
       T2S[Find(T, ufc)] = S->top-1;
+#if defined(RANGE)
+      rangeMark(ufc);
+#endif
       ufc++;
+      open++;
+      if(peakOpen < open)
+        peakOpen = open;
 
       break;
 
@@ -395,23 +757,76 @@ main(int argc, char** argv){
 
       vout = S->M[T2S[Find(T, get(H, qi))]].v;
 
-      printf("%d ", 1+qi);
-      printf("%d ", pos);
-      printf("%d\n", vout);
+      answer(1+qi, pos, vout);
 
-      if(closeQ == c) /* Close marking */
+      if(closeQ == c){ /* Close marking */
+#if defined(RANGE)
+        rangeClose(get(H, qi));
+#endif
         delete(H, qi);
+        open--;
+      }
       break;
+
+    case batchQ: /* Answered one by one */
+      for(k = getInt(); 0 < k; k--){
+        qi = getInt();
+        vout = S->M[T2S[Find(T, get(H, qi-1))]].v;
+
+        answer(qi, pos, vout);
+      }
+      break;
+
+    case rangeQ: /* Between two marks */
+      qi = getInt();
+      qj = getInt();
+      if(qj < qi){
+        k = qi;
+        qi = qj;
+        qj = k;
+      }
+#if defined(RANGE)
+      vout = rangeCmd(get(H, qi-1), get(H, qj-1));
+
+      answer(qi, qj, vout);
+#else
+      fprintf(stderr, "Range queries need RANGE.\n");
+      return 1;
+#endif
+      break;
+
+    case topkQ: /* Smallest values since a mark */
+      getInt();
+      getInt();
+      fprintf(stderr, "Top k queries are only answered by T2.\n");
+      return 1;
+
     default:
       break;
     }
     c = getInt();
   }
 
-  free(T2S);
-  free(T);
-  free(H->T);
-  free(H);
+  if(stats){
+    if(reclaim)
+      fprintf(stderr, "rebuilds %d\n", rebuilds);
+    memReport(open, peakOpen);
+  }
+
+  if(NULL != inRing)
+    ringsDetach();
+#if defined(URING)
+  else
+    uringClose();
+#endif
+  memAdd(memT2S, -cap*sizeof(int));
+  cacheFree(T2S, cap*sizeof(int));
+  memAdd(memUF, -cap*sizeof(int));
+  cacheFree(T, cap*sizeof(int));
+#if defined(RANGE)
+  freeRanges(R);
+#endif
+  freeHash(H);
   freeStack(S);
 
   return 0;
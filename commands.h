@@ -7,7 +7,10 @@ enum commands {
     value = 1,
     mark,
     query,
-    closeQ
+    closeQ,
+    rangeQ,
+    batchQ,
+    topkQ
   };
 
 #endif /* COMMANDS_H */
@@ -0,0 +1,284 @@
+/* MIT License */
+
+/* Copyright (c) 2021 Luís M. S. Russo */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+
+
+/* Fixed capacity engine, header only, with no heap allocation. */
+
+/* FIXED_RMQ(name, cap, type, least) defines struct name, for at most cap */
+/* marks open at once over values of type, where least is below every */
+/* value, and the functions */
+
+/*   nameInit(F)       empty structure, before anything else */
+/*   nameValue(F, v)   appends the value v */
+/*   nameMark(F)       marks the last position and returns its key, or */
+/*                     -1 when cap marks are already open */
+/*   nameQuery(F, k)   minimum since the mark with key k */
+/*   nameClose(F, k)   the same, and closes the mark */
+
+/* It follows T2 with the stack items knowing their set. Every array is */
+/* a member of the struct, sized from cap at compile time, and the hash */
+/* is open addressing over 4*cap slots with a multiplicative hash. When */
+/* the 2*cap union find items are used up the structure is compacted in */
+/* place to the open marks, through scratch arrays of the struct. */
+
+#ifndef FIXED_H
+#define FIXED_H
+
+#include <string.h>
+
+#define FIXED_RMQ(NAME, CAP, TYPE, LEAST)                               \
+                                                                        \
+enum { NAME##U = 2*(CAP), /* Union find items */                        \
+       NAME##H = 4*(CAP) }; /* Hash slots */                            \
+                                                                        \
+struct NAME{                                                            \
+  int pos; /* Next position, 0 has no sign */                           \
+  int stub; /* Last element on the stack */                             \
+  int stubQ; /* The last value went into the stub */                    \
+  int lst; /* Next union find item */                                   \
+  int n; /* Open marks */                                               \
+  TYPE Sv[NAME##U + 2]; /* Stack values */                              \
+  int Sufi[NAME##U + 2]; /* Union find item of a stack item */          \
+  int Seti[NAME##U + 1]; /* Parent or negative rank */                  \
+  int Stacki[NAME##U + 1]; /* Stack item of a root */                   \
+  int Hkey[NAME##H]; /* Mark keys plus 1, 0 for empty */                \
+  int Hval[NAME##H]; /* Union find items, negative when closed */       \
+  int Map[NAME##U + 2]; /* Compaction scratch, new stack items */       \
+  int Key[(CAP) + 1]; /* Compaction scratch, open keys */               \
+  int Lst[(CAP) + 1]; /* Compaction scratch, their old stack items */   \
+};                                                                      \
+                                                                        \
+static inline int                                                       \
+NAME##Slot(struct NAME *F,                                              \
+           int key                                                      \
+           )                                                            \
+{ /* Slot of key, or the empty one where it goes */                     \
+  unsigned int i = (unsigned int)key*2654435761u % NAME##H;             \
+                                                                        \
+  while(0 != F->Hkey[i] && 1+key != F->Hkey[i])                         \
+    if(NAME##H == ++i)                                                  \
+      i = 0;                                                            \
+                                                                        \
+  return i;                                                             \
+}                                                                       \
+                                                                        \
+static inline void                                                      \
+NAME##Insert(struct NAME *F,                                            \
+             int key,                                                   \
+             int ufi                                                    \
+             )                                                          \
+{                                                                       \
+  int i = NAME##Slot(F, key);                                           \
+  F->Hkey[i] = 1+key;                                                   \
+  F->Hval[i] = ufi;                                                     \
+}                                                                       \
+                                                                        \
+static inline int                                                       \
+NAME##Find(struct NAME *F,                                              \
+           int p                                                        \
+           )                                                            \
+{ /* Path halving */                                                    \
+  while(0 <= F->Seti[p]){                                               \
+    int n = F->Seti[p];                                                 \
+    if(0 <= F->Seti[n]){                                                \
+      F->Seti[p] = F->Seti[n];                                          \
+      n = F->Seti[n];                                                   \
+    }                                                                   \
+    p = n;                                                              \
+  }                                                                     \
+                                                                        \
+  return p;                                                             \
+}                                                                       \
+                                                                        \
+static inline int                                                       \
+NAME##Link(struct NAME *F,                                              \
+           int r,                                                       \
+           int p                                                        \
+           )                                                            \
+{ /* Links roots r and p by rank, returns the new root */               \
+  if(F->Seti[p] < F->Seti[r]){                                          \
+    F->Seti[r] = p;                                                     \
+    return p;                                                           \
+  }                                                                     \
+  if(F->Seti[p] == F->Seti[r])                                          \
+    F->Seti[r]--;                                                       \
+  F->Seti[p] = r;                                                       \
+                                                                        \
+  return r;                                                             \
+}                                                                       \
+                                                                        \
+static inline void                                                      \
+NAME##Union(struct NAME *F,                                             \
+            int p,                                                      \
+            int q                                                       \
+            )                                                           \
+{ /* The root keeps the lowest stack item */                            \
+  int rp = NAME##Find(F, p);                                            \
+  int rq = NAME##Find(F, q);                                            \
+                                                                        \
+  if(rp != rq){                                                         \
+    int s = F->Stacki[rp] < F->Stacki[rq] ? F->Stacki[rp] : F->Stacki[rq]; \
+    F->Stacki[NAME##Link(F, rq, rp)] = s;                               \
+  }                                                                     \
+}                                                                       \
+                                                                        \
+static inline void                                                      \
+NAME##Init(struct NAME *F                                               \
+           )                                                            \
+{                                                                       \
+  F->pos = 1;                                                           \
+  F->stub = 1; /* Above the item that is below every value */           \
+  F->stubQ = 0;                                                         \
+  F->lst = 1; /* Item 0 is not used */                                  \
+  F->n = 0;                                                             \
+  F->Sv[0] = LEAST;                                                     \
+  F->Sufi[0] = 0;                                                       \
+  for(int i = 0; i <= NAME##U; i++)                                     \
+    F->Seti[i] = -1;                                                    \
+  memset(F->Hkey, 0, sizeof(F->Hkey));                                  \
+}                                                                       \
+                                                                        \
+static inline void                                                      \
+NAME##Value(struct NAME *F,                                             \
+            TYPE v                                                      \
+            )                                                           \
+{                                                                       \
+  int t = F->stub - 1; /* Top */                                        \
+                                                                        \
+  if(F->Sv[t] <= v){ /* Larger, goes into the stub */                   \
+    F->Sv[F->stub] = v;                                                 \
+    F->stubQ = 1;                                                       \
+  } else { /* Smaller, contract the stack */                            \
+    int k = t - 1; /* Stays in the stack */                             \
+    while(F->Sv[k] >= v)                                                \
+      k--;                                                              \
+    if(k+1 < t){ /* Merge the sets of k+1 to t into the set of k+1 */   \
+      int r = NAME##Find(F, F->Sufi[t]);                                \
+      for(int b = t - 1; k < b; b--)                                    \
+        r = NAME##Link(F, r, NAME##Find(F, F->Sufi[b]));                \
+      F->Stacki[r] = k+1;                                               \
+    }                                                                   \
+    F->stub = k+2;                                                      \
+    F->stubQ = 0;                                                       \
+    F->Sv[k+1] = v;                                                     \
+  }                                                                     \
+  F->pos++;                                                             \
+}                                                                       \
+                                                                        \
+static void __attribute__((noinline, cold))                            \
+NAME##Compact(struct NAME *F                                            \
+              )                                                         \
+{ /* Keeps only the open marks and the stack items they use */          \
+  int n = 0;                                                            \
+  for(int i = 0; i < NAME##H; i++)                                      \
+    if(0 != F->Hkey[i] && 0 < F->Hval[i]){                              \
+      n++;                                                              \
+      F->Key[n] = F->Hkey[i] - 1;                                       \
+      F->Lst[n] = F->Stacki[NAME##Find(F, F->Hval[i])];                 \
+    }                                                                   \
+                                                                        \
+  for(int i = 0; i < F->stub; i++)                                      \
+    F->Map[i] = 0; /* Unused */                                         \
+  for(int j = 1; j <= n; j++)                                           \
+    F->Map[F->Lst[j]] = 1;                                              \
+                                                                        \
+  /* The top holds the current value, keep it as the stub */            \
+  int t = F->stub - 1;                                                  \
+  TYPE stubV = F->Sv[F->stub];                                          \
+  if(!F->stubQ && 0 < t && 0 == F->Map[t]){                             \
+    stubV = F->Sv[t];                                                   \
+    F->stubQ = 1;                                                       \
+  }                                                                     \
+                                                                        \
+  int j = 1; /* New stack items, never above the old ones */            \
+  for(int i = 1; i < F->stub; i++)                                      \
+    if(F->Map[i]){                                                      \
+      F->Sv[j] = F->Sv[i];                                              \
+      F->Map[i] = j;                                                    \
+      j++;                                                              \
+    }                                                                   \
+  F->stub = j;                                                          \
+  F->Sv[j] = stubV;                                                     \
+                                                                        \
+  memset(F->Hkey, 0, sizeof(F->Hkey));                                  \
+  for(int i = 0; i <= NAME##U; i++)                                     \
+    F->Seti[i] = -1;                                                    \
+  for(j = 1; j <= n; j++){                                              \
+    NAME##Insert(F, F->Key[j], j);                                      \
+    F->Stacki[j] = F->Map[F->Lst[j]];                                   \
+    F->Sufi[F->Stacki[j]] = j;                                          \
+  }                                                                     \
+  for(j = 1; j <= n; j++)                                               \
+    NAME##Union(F, j, F->Sufi[F->Stacki[j]]);                           \
+  F->lst = n + 1;                                                       \
+}                                                                       \
+                                                                        \
+static inline int                                                       \
+NAME##Mark(struct NAME *F                                               \
+           )                                                            \
+{                                                                       \
+  if((CAP) == F->n) /* Key and Lst hold at most CAP marks */            \
+    return -1;                                                          \
+  if(NAME##U + 1 == F->lst) /* Union find is full */                    \
+    NAME##Compact(F);                                                   \
+                                                                        \
+  int u = F->lst;                                                       \
+  NAME##Insert(F, F->pos - 1, u);                                       \
+  F->Stacki[u] = F->stub;                                               \
+  if(F->stubQ){ /* Put the stub on the stack */                         \
+    F->Sufi[F->stub] = u;                                               \
+    F->stub++;                                                          \
+    F->stubQ = 0;                                                       \
+  } else                                                                \
+    NAME##Union(F, u, F->Sufi[F->stub - 1]);                            \
+  F->lst++;                                                             \
+  F->n++;                                                               \
+                                                                        \
+  return F->pos - 1;                                                    \
+}                                                                       \
+                                                                        \
+static inline TYPE                                                      \
+NAME##Query(struct NAME *F,                                             \
+            int key                                                     \
+            )                                                           \
+{                                                                       \
+  int u = F->Hval[NAME##Slot(F, key)];                                  \
+  if(0 > u) /* Closed */                                                \
+    u = -u;                                                             \
+                                                                        \
+  return F->Sv[F->Stacki[NAME##Find(F, u)]];                            \
+}                                                                       \
+                                                                        \
+static inline TYPE                                                      \
+NAME##Close(struct NAME *F,                                             \
+            int key                                                     \
+            )                                                           \
+{                                                                       \
+  int i = NAME##Slot(F, key);                                           \
+  TYPE v = F->Sv[F->Stacki[NAME##Find(F, F->Hval[i])]];                 \
+  F->Hval[i] = -F->Hval[i];                                             \
+  F->n--;                                                               \
+                                                                        \
+  return v;                                                             \
+}
+
+#endif /* FIXED_H */
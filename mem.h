@@ -0,0 +1,181 @@
+/* MIT License */
+
+/* Copyright (c) 2021 Luís M. S. Russo */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+
+
+/* Memory accounting, bytes in use by each component of an engine. */
+
+/* Engines call memAdd() with the bytes they alloc, and the negation of */
+/* the bytes they free. memReport() prints the live and peak bytes of */
+/* each component and relates them to the number of open marks. When */
+/* memTLBOpen() was called first it also prints the data TLB misses. */
+
+/* Their arrays come from cacheAlloc(), aligned to a cache line, and go */
+/* back with cacheFree(). With HUGEPAGE those of HUGESIZE or more are */
+/* mapped in huge pages. */
+
+#ifndef MEM_H
+#define MEM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#if defined(HUGEPAGE)
+#include <sys/mman.h>
+#endif
+#if defined(__linux__)
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+enum memParts {
+  memHash,
+  memUF,
+  memStack,
+  memT2S,
+  memRange,
+  memTopk,
+  memParts
+};
+
+static const char *memNames[] = {"hash", "UF", "stack", "T2S", "range",
+                                  "top k"};
+
+#define CACHELINE 64
+#define HUGESIZE (2 << 20) /* Huge page, for allocs of HUGEPAGE builds */
+
+static long long memLive[memParts + 1]; /* Last one is the total */
+static long long memPeak[memParts + 1];
+static int memTLB = -1; /* Counter of data TLB misses */
+
+static void
+memAdd(int part,
+       long long n /* Bytes, negative when freed */
+       )
+{
+  memLive[part] += n;
+  if(memPeak[part] < memLive[part])
+    memPeak[part] = memLive[part];
+
+  memLive[memParts] += n;
+  if(memPeak[memParts] < memLive[memParts])
+    memPeak[memParts] = memLive[memParts];
+}
+
+static void
+memTLBOpen(void)
+{ /* Counts the TLB misses of loads from here on, if the kernel allows */
+#if defined(__linux__)
+  struct perf_event_attr a;
+
+  memset(&a, 0, sizeof(a));
+  a.size = sizeof(a);
+  a.type = PERF_TYPE_HW_CACHE;
+  a.config = PERF_COUNT_HW_CACHE_DTLB
+    | PERF_COUNT_HW_CACHE_OP_READ << 8
+    | PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+  a.exclude_kernel = 1;
+  a.exclude_hv = 1;
+  memTLB = syscall(SYS_perf_event_open, &a, 0, -1, -1, 0);
+#endif
+}
+
+static void
+memReport(long long open, /* Number of open marks */
+          long long peakOpen /* Largest number of open marks */
+          )
+{
+  fprintf(stderr, "%-12s %14s %14s\n", "memory", "live(B)", "peak(B)");
+  for(int i = 0; i < memParts; i++)
+    if(0 < memPeak[i])
+      fprintf(stderr, "%-12s %14lld %14lld\n", memNames[i],
+              memLive[i], memPeak[i]);
+  fprintf(stderr, "%-12s %14lld %14lld\n", "total",
+          memLive[memParts], memPeak[memParts]);
+
+  fprintf(stderr, "open marks %lld, peak %lld\n", open, peakOpen);
+  if(0 < open)
+    fprintf(stderr, "bits per open mark %.1f\n",
+            8.0*memLive[memParts]/open);
+  if(0 < peakOpen)
+    fprintf(stderr, "peak bits per peak open mark %.1f\n",
+            8.0*memPeak[memParts]/peakOpen);
+  if(0 < memLive[memParts])
+    fprintf(stderr, "peak/live %.2f\n",
+            (double)memPeak[memParts]/memLive[memParts]);
+
+  long long m;
+  if(-1 != memTLB && sizeof(m) == read(memTLB, &m, sizeof(m)))
+    fprintf(stderr, "dTLB misses %lld\n", m);
+}
+
+static inline void *
+cacheAlloc(size_t n
+           )
+{ /* Alloc n bytes starting at a cache line */
+  n = (n + CACHELINE - 1) / CACHELINE * CACHELINE;
+#if defined(HUGEPAGE)
+  if(HUGESIZE <= n){ /* Whole huge pages, reserved ones if there are any */
+    n = (n + HUGESIZE - 1) / HUGESIZE * HUGESIZE;
+    void *r = mmap(NULL, n, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if(MAP_FAILED != r)
+      return r;
+
+    /* Transparent huge pages need aligned regions, trim the extra page */
+    char *m = mmap(NULL, n + HUGESIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(MAP_FAILED != m && "Failed alloc.");
+    size_t h = (HUGESIZE - (uintptr_t)m % HUGESIZE) % HUGESIZE; /* Head */
+    if(0 < h)
+      munmap(m, h);
+    if(h < HUGESIZE)
+      munmap(m + h + n, HUGESIZE - h);
+    madvise(m + h, n, MADV_HUGEPAGE);
+
+    return m + h;
+  }
+#endif
+  void *r = aligned_alloc(CACHELINE, n);
+  assert(NULL != r && "Failed alloc.");
+
+  return r;
+}
+
+static inline void
+cacheFree(void *p,
+          size_t n /* Bytes given to cacheAlloc */
+          )
+{
+#if defined(HUGEPAGE)
+  n = (n + CACHELINE - 1) / CACHELINE * CACHELINE;
+  if(HUGESIZE <= n){
+    munmap(p, (n + HUGESIZE - 1) / HUGESIZE * HUGESIZE);
+    return;
+  }
+#endif
+  free(p);
+}
+
+#endif /* MEM_H */
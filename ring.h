@@ -0,0 +1,329 @@
+/* MIT License */
+
+/* Copyright (c) 2021 Luís M. S. Russo */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+
+
+/* Single producer, single consumer ring of integers in shared memory. */
+
+/* A process creates the ring with ringCreate() and another one maps it */
+/* with ringAttach(). The producer appends with ringWrite() and calls */
+/* ringClose() at the end. The consumer gets the integers in place, */
+/* without copies, with ringRead() and gives them back with ringRelease(). */
+/* A producer that must not block on a full ring uses ringPut() and */
+/* ringWaitRoom() instead of ringWrite(). */
+/* Both sides spin for a while and then sleep on a futex of the counter */
+/* they wait for. */
+
+#ifndef RING_H
+#define RING_H
+
+#include <stdio.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <assert.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define RSPIN 1024 /* Spins before sleeping */
+#define RANSWERS 3072 /* Integers of answers written together */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ringPause() __builtin_ia32_pause()
+#else
+#define ringPause()
+#endif
+
+struct ring{
+  _Atomic unsigned int head; /* Integers written, by the producer */
+  _Atomic int waitC; /* The consumer sleeps on head */
+  char pad0[64 - 2*sizeof(int)];
+  _Atomic unsigned int tail; /* Integers released, by the consumer */
+  _Atomic int waitP; /* The producer sleeps on tail */
+  char pad1[64 - 2*sizeof(int)];
+  _Atomic int closed; /* The producer is done */
+  unsigned int size; /* Integers in D, a power of 2 */
+  int D[];
+};
+
+typedef struct ring *ring;
+
+static inline ring
+ringMap(const char *name,
+        unsigned int size, /* Integers, 0 to attach */
+        int flags
+        )
+{
+  int fd = shm_open(name, flags, 0600);
+  assert(-1 != fd && "Failed shared memory open.");
+
+  size_t n = sizeof(struct ring) + size*sizeof(int);
+  if(0 == size){ /* Read the size of the existing ring */
+    struct ring h;
+    ssize_t r = pread(fd, &h, sizeof(h), 0);
+    assert(sizeof(h) == r && "Broken ring.");
+    (void)r;
+    n += h.size*sizeof(int);
+  } else {
+    int r = ftruncate(fd, n);
+    assert(0 == r && "Failed shared memory size.");
+    (void)r;
+  }
+
+  ring r = mmap(NULL, n, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  assert(MAP_FAILED != r && "Failed shared memory map.");
+  close(fd);
+
+  return r;
+}
+
+static inline ring
+ringCreate(const char *name,
+           unsigned int size /* Integers, a power of 2 */
+           )
+{
+  assert(0 == (size & (size - 1)) && "Ring size not a power of 2.");
+  shm_unlink(name);
+  ring r = ringMap(name, size, O_RDWR | O_CREAT | O_EXCL);
+  r->size = size;
+
+  return r;
+}
+
+static inline ring
+ringAttach(const char *name
+           )
+{
+  return ringMap(name, 0, O_RDWR);
+}
+
+static inline void
+ringUnmap(ring r
+          )
+{
+  munmap(r, sizeof(struct ring) + r->size*sizeof(int));
+}
+
+static inline void
+ringWait(_Atomic unsigned int *c,
+         unsigned int v, /* Wait while *c is v */
+         _Atomic int *w /* Sleeping flag */
+         )
+{
+  struct timespec t = {0, 1000000}; /* Also wake up to look at closed */
+
+  for(int i = 0; i < RSPIN; i++){
+    if(v != atomic_load(c))
+      return;
+    ringPause();
+  }
+
+  atomic_store(w, 1);
+  if(v == atomic_load(c))
+    syscall(SYS_futex, c, FUTEX_WAIT, v, &t, NULL, 0);
+  atomic_store(w, 0);
+}
+
+static inline void
+ringWake(_Atomic unsigned int *c,
+         _Atomic int *w
+         )
+{ /* The fence orders the store of *c before the load of the flag, as */
+  /* ringWait orders the store of the flag before the load of *c */
+  atomic_thread_fence(memory_order_seq_cst);
+  if(atomic_load(w))
+    syscall(SYS_futex, c, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+static inline unsigned int
+ringPut(ring r,
+        const int *X,
+        unsigned int n
+        )
+{ /* Appends up to n integers of X without waiting, returns how many, */
+  /* 0 when the ring is full */
+  unsigned int h = atomic_load_explicit(&r->head, memory_order_relaxed);
+  unsigned int t = atomic_load_explicit(&r->tail, memory_order_acquire);
+  unsigned int m = r->size - (h - t); /* Room */
+  unsigned int i = h & (r->size - 1);
+
+  if(r->size - i < m) /* Up to the end of D */
+    m = r->size - i;
+  if(n < m)
+    m = n;
+  if(0 < m){
+    memcpy(&r->D[i], X, m*sizeof(int));
+    atomic_store_explicit(&r->head, h + m, memory_order_release);
+    ringWake(&r->head, &r->waitC);
+  }
+
+  return m;
+}
+
+static inline void
+ringWaitRoom(ring r
+             )
+{ /* Waits while the ring is full, that is while tail is head - size, */
+  /* or for the timeout of ringWait */
+  unsigned int h = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+  ringWait(&r->tail, h - r->size, &r->waitP);
+}
+
+static inline void
+ringWrite(ring r,
+          const int *X,
+          unsigned int n
+          )
+{ /* Appends the n integers of X, waits for room */
+  while(0 < n){
+    unsigned int m = ringPut(r, X, n);
+    if(0 == m)
+      ringWaitRoom(r);
+    X += m;
+    n -= m;
+  }
+}
+
+static inline void
+ringClose(ring r
+          )
+{
+  atomic_store(&r->closed, 1);
+  ringWake(&r->head, &r->waitC);
+}
+
+static inline unsigned int
+ringRead(ring r,
+         int **P
+         )
+{ /* Points P at the next integers and returns how many, 0 at the end */
+  unsigned int t = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+  while(1){
+    unsigned int h = atomic_load_explicit(&r->head, memory_order_acquire);
+    if(h != t){
+      unsigned int i = t & (r->size - 1);
+      *P = &r->D[i];
+      if(r->size - i < h - t) /* Up to the end of D */
+        h = t + r->size - i;
+      if(r->size/8 < h - t) /* Give room back often */
+        h = t + r->size/8;
+      return h - t;
+    }
+    if(atomic_load(&r->closed)
+       && h == atomic_load_explicit(&r->head, memory_order_acquire))
+      return 0;
+    ringWait(&r->head, h, &r->waitC);
+  }
+}
+
+static inline void
+ringRelease(ring r,
+            unsigned int n /* Integers from ringRead that were used */
+            )
+{
+  atomic_fetch_add_explicit(&r->tail, n, memory_order_release);
+  ringWake(&r->tail, &r->waitP);
+}
+
+/* Engines read commands from inRing and write answers to outRing when */
+/* they are attached, with ringFill() and answer(). Otherwise answer() */
+/* prints, through io_uring when built with URING. */
+
+static ring inRing = NULL;
+static ring outRing = NULL;
+static unsigned int inHeld = 0; /* Integers of inRing being read */
+static int answers[RANSWERS];
+static int nAnswers = 0;
+
+static inline void
+ringsAttach(const char *name
+            )
+{ /* Attaches to the rings name-in and name-out */
+  char n[256];
+
+  snprintf(n, sizeof(n), "%s-in", name);
+  inRing = ringAttach(n);
+  snprintf(n, sizeof(n), "%s-out", name);
+  outRing = ringAttach(n);
+}
+
+static inline void
+answerFlush(void)
+{
+  if(NULL != outRing && 0 < nAnswers){
+    ringWrite(outRing, answers, nAnswers);
+    nAnswers = 0;
+  }
+}
+
+static inline void
+answer(int i,
+       int pos,
+       int v
+       )
+{ /* Outputs one answer, to outRing or stdout */
+  if(NULL == outRing){
+#if defined(URING)
+    if(uringOut){
+      uringAnswer(i, pos, v);
+      return;
+    }
+#endif
+    printf("%d ", i);
+    printf("%d ", pos);
+    printf("%d\n", v);
+    return;
+  }
+
+  if(RANSWERS == nAnswers)
+    answerFlush();
+  answers[nAnswers++] = i;
+  answers[nAnswers++] = pos;
+  answers[nAnswers++] = v;
+}
+
+static inline int
+ringFill(int **P
+         )
+{ /* Gives back the last integers of inRing and points P at the next ones */
+  /* Returns their bytes, 0 at the end. Pending answers are sent first, */
+  /* as this may wait. */
+  answerFlush();
+  ringRelease(inRing, inHeld);
+  inHeld = ringRead(inRing, P);
+
+  return 4*inHeld;
+}
+
+static inline void
+ringsDetach(void)
+{
+  answerFlush();
+  ringClose(outRing);
+  ringUnmap(inRing);
+  ringUnmap(outRing);
+}
+
+#endif /* RING_H */
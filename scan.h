@@ -0,0 +1,114 @@
+/* MIT License */
+
+/* Copyright (c) 2021 Luís M. S. Russo */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+
+/* Search for the cut point of the stack contraction. */
+
+/* The stack values are non decreasing and position 0 holds INT_MIN. Given */
+/* the values V, spaced stride integers apart, cut(V, stride, i, v) returns */
+/* the largest index k <= i such that V[k] < v. Every position above k is */
+/* popped by the contraction. Call selectCut() once before using cut. */
+
+#ifndef SCAN_H
+#define SCAN_H
+
+static int
+cutScalar(const int *V,
+          int stride,
+          int i,
+          int v
+          )
+{
+  while(V[stride*i] >= v)
+    i--;
+
+  return i;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+__attribute__((target("avx2"))) static int
+cutAVX2(const int *V,
+        int stride,
+        int i,
+        int v
+        )
+{
+  const int w = 8/stride; /* Items per vector */
+  int lanes = 0; /* Lanes holding values */
+  for(int l = 0; l < w; l++)
+    lanes |= 1 << (stride*l);
+  __m256i x = _mm256_set1_epi32(v);
+
+  while(V[stride*i] >= v && w <= i){
+    i -= w - 1; /* First item of the vector */
+    __m256i y = _mm256_loadu_si256((const __m256i *)&V[stride*i]);
+    int m = lanes & _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(x, y)));
+    if(0 != m) /* Highest lane smaller than v */
+      return i + (31 - __builtin_clz(m))/stride;
+    i--;
+  }
+
+  return cutScalar(V, stride, i, v);
+}
+
+__attribute__((target("avx512f"))) static int
+cutAVX512(const int *V,
+          int stride,
+          int i,
+          int v
+          )
+{
+  const int w = 16/stride; /* Items per vector */
+  int lanes = 0; /* Lanes holding values */
+  for(int l = 0; l < w; l++)
+    lanes |= 1 << (stride*l);
+  __m512i x = _mm512_set1_epi32(v);
+
+  while(V[stride*i] >= v && w <= i){
+    i -= w - 1; /* First item of the vector */
+    __m512i y = _mm512_loadu_si512((const void *)&V[stride*i]);
+    int m = lanes & _mm512_cmplt_epi32_mask(y, x);
+    if(0 != m) /* Highest lane smaller than v */
+      return i + (31 - __builtin_clz(m))/stride;
+    i--;
+  }
+
+  return cutScalar(V, stride, i, v);
+}
+#endif /* x86 */
+
+static int (*cut)(const int *, int, int, int) = cutScalar;
+
+static void
+selectCut(void)
+{ /* Picks the widest vector unit of this CPU */
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx512f"))
+    cut = cutAVX512;
+  else if(__builtin_cpu_supports("avx2"))
+    cut = cutAVX2;
+#endif
+}
+
+#endif /* SCAN_H */
@@ -0,0 +1,142 @@
+/* MIT License */
+
+/* Copyright (c) 2021 Luís M. S. Russo */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+
+
+/* Optional instrumentation, compiled in with -DSTATS. */
+
+/* Histograms are HDR style, a value v lands in a bucket given by the */
+/* position of its highest bit and the HBITS bits starting at it, so */
+/* every bucket is within 1/2^(HBITS-1) of its values. Without STATS the STAT() */
+/* macro drops its argument and nothing remains in the binary. Setting */
+/* statsOff keeps the bulk work of a rebuild out of the histograms. */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <time.h>
+
+static long long
+nsNow(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+
+  return t.tv_sec*1000000000LL + t.tv_nsec;
+}
+
+#if defined(STATS)
+
+#include <stdio.h>
+#include <signal.h>
+
+#define STAT(...) __VA_ARGS__
+
+#define HBITS 4 /* Sub bucket bits */
+#define HSIZE ((64 - HBITS + 1) << HBITS)
+
+struct hist{
+  const char *name;
+  long long n; /* Number of recorded values */
+  long long sum;
+  long long max;
+  long long B[HSIZE]; /* Buckets */
+};
+
+static int
+histBucket(long long v
+           )
+{
+  if(v < (1 << HBITS))
+    return (int)v;
+
+  int e = 63 - __builtin_clzll(v) - HBITS + 1; /* Shift to HBITS bits */
+
+  return (e << HBITS) + (int)(v >> e);
+}
+
+static long long
+histValue(int b
+          )
+{ /* Largest value in bucket b */
+  if(b < (1 << HBITS))
+    return b;
+
+  int e = b >> HBITS;
+
+  return ((long long)((b & ((1 << HBITS) - 1)) + 1) << e) - 1;
+}
+
+static int statsOff = 0; /* Rebuilding, histRecord() drops the values */
+
+static void
+histRecord(struct hist *h,
+           long long v
+           )
+{
+  if(statsOff)
+    return;
+  h->B[histBucket(v)]++;
+  h->n++;
+  h->sum += v;
+  if(h->max < v)
+    h->max = v;
+}
+
+static void
+histPrint(struct hist *h
+          )
+{
+  static const double P[] = {0.5, 0.9, 0.99, 0.999};
+  long long c = 0;
+  int b = 0;
+
+  fprintf(stderr, "%-12s n %lld", h->name, h->n);
+  if(0 < h->n){
+    fprintf(stderr, " mean %.1f", (double)h->sum/h->n);
+    for(int i = 0; i < 4; i++){
+      while(c < P[i]*h->n)
+        c += h->B[b++];
+      long long v = histValue(b - 1);
+      fprintf(stderr, " p%g %lld", 100*P[i], v < h->max ? v : h->max);
+    }
+    fprintf(stderr, " max %lld", h->max);
+  }
+  fprintf(stderr, "\n");
+}
+
+static volatile sig_atomic_t statsQ = 0; /* Dump was requested */
+
+static void
+statsSignal(int sig
+            )
+{
+  (void)sig;
+  statsQ = 1;
+}
+
+#else
+
+#define STAT(...)
+
+#endif /* STATS */
+
+#endif /* STATS_H */
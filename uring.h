@@ -0,0 +1,346 @@
+/* MIT License */
+
+/* Copyright (c) 2021 Luís M. S. Russo */
+
+/* Permission is hereby granted, free of charge, to any person obtaining a copy */
+/* of this software and associated documentation files (the "Software"), to deal */
+/* in the Software without restriction, including without limitation the rights */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell */
+/* copies of the Software, and to permit persons to whom the Software is */
+/* furnished to do so, subject to the following conditions: */
+
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software. */
+
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE */
+/* SOFTWARE. */
+
+
+/* Input and output of the engines through io_uring, on Linux. */
+
+/* uringOpen() sets up a ring when the kernel allows it. When stdin is a */
+/* regular file URDEPTH reads of URCHUNK bytes are kept in flight ahead of */
+/* the consumer, which gets them in place with uringFill(). Answers are */
+/* written into one of two buffers with uringAnswer() and each full buffer */
+/* is written asynchronously while the other one fills, whatever stdout */
+/* is. uringClose() writes what is left. Input that is not a regular file */
+/* is left to read(), and without a ring answers are left to printf(). */
+
+#ifndef URING_H
+#define URING_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <assert.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#define URDEPTH 4 /* Reads in flight */
+#define URCHUNK (1 << 20) /* Bytes per read and per answer buffer */
+#define UROUT URDEPTH /* user_data of the answer writes */
+
+struct uring{
+  int fd;
+  void *sqMap; /* Submission ring */
+  size_t sqSize;
+  void *cqMap; /* Completion ring, may be sqMap */
+  size_t cqSize;
+  struct io_uring_sqe *sqes;
+  size_t sqesSize;
+  _Atomic unsigned int *sqTail;
+  unsigned int *sqMask;
+  unsigned int *sqArray;
+  _Atomic unsigned int *cqHead;
+  _Atomic unsigned int *cqTail;
+  unsigned int *cqMask;
+  struct io_uring_cqe *cqes;
+
+  off_t inSize; /* Bytes of stdin */
+  off_t inNext; /* Offset of the next read */
+  char *B[URDEPTH]; /* Read buffers, used in turn */
+  off_t off[URDEPTH]; /* Offset read into each one */
+  int len[URDEPTH]; /* Bytes asked, 0 past the end */
+  int res[URDEPTH]; /* Bytes read */
+  int pend[URDEPTH]; /* Read in flight */
+  int cur; /* Buffer being consumed, -1 before the first */
+
+  char *O[2]; /* Answer buffers */
+  int oCur; /* Buffer being filled */
+  int oLen; /* Its bytes */
+  int oSent; /* Bytes of the write in flight, 0 for none */
+  int oPend; /* Write in flight */
+  int oRes;
+};
+
+static struct uring ur;
+static int uringIn = 0; /* Reading stdin through the ring */
+static int uringOut = 0; /* Writing answers through the ring */
+
+static void
+uringSubmit(int op,
+            int fd,
+            void *b,
+            unsigned int n,
+            off_t off,
+            unsigned long long data
+            )
+{ /* Submits one read or write */
+  unsigned int t = atomic_load_explicit(ur.sqTail, memory_order_relaxed);
+  unsigned int i = t & *ur.sqMask;
+  struct io_uring_sqe *e = &ur.sqes[i];
+
+  memset(e, 0, sizeof(*e));
+  e->opcode = op;
+  e->fd = fd;
+  e->addr = (unsigned long)b;
+  e->len = n;
+  e->off = off;
+  e->user_data = data;
+  ur.sqArray[i] = i;
+  atomic_store_explicit(ur.sqTail, t + 1, memory_order_release);
+  long r = syscall(__NR_io_uring_enter, ur.fd, 1, 0, 0, NULL, 0);
+  assert(1 == r && "Failed io_uring submission.");
+  (void)r;
+}
+
+static void
+uringReap(void)
+{ /* Waits for one completion and records it */
+  unsigned int h = atomic_load_explicit(ur.cqHead, memory_order_relaxed);
+
+  while(h == atomic_load_explicit(ur.cqTail, memory_order_acquire))
+    syscall(__NR_io_uring_enter, ur.fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+
+  struct io_uring_cqe *c = &ur.cqes[h & *ur.cqMask];
+  if(UROUT == c->user_data){
+    ur.oRes = c->res;
+    ur.oPend = 0;
+  } else {
+    ur.res[c->user_data] = c->res;
+    ur.pend[c->user_data] = 0;
+  }
+  atomic_store_explicit(ur.cqHead, h + 1, memory_order_release);
+}
+
+static void
+uringRead(int s
+          )
+{ /* Reads the next chunk of stdin into buffer s */
+  off_t n = ur.inSize - ur.inNext;
+
+  if(URCHUNK < n)
+    n = URCHUNK;
+  ur.len[s] = n;
+  if(0 == n)
+    return;
+  ur.pend[s] = 1;
+  ur.off[s] = ur.inNext;
+  uringSubmit(IORING_OP_READ, 0, ur.B[s], n, ur.inNext, s);
+  ur.inNext += n;
+}
+
+static void
+uringOpen(void)
+{
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  ur.fd = syscall(__NR_io_uring_setup, 2*URDEPTH, &p);
+  if(0 > ur.fd) /* No io_uring, keep read() and printf() */
+    return;
+
+  ur.sqSize = p.sq_off.array + p.sq_entries*sizeof(unsigned int);
+  ur.cqSize = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+  if(p.features & IORING_FEAT_SINGLE_MMAP){
+    if(ur.sqSize < ur.cqSize)
+      ur.sqSize = ur.cqSize;
+    ur.cqSize = 0;
+  }
+  ur.sqMap = mmap(NULL, ur.sqSize, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, ur.fd, IORING_OFF_SQ_RING);
+  assert(MAP_FAILED != ur.sqMap && "Failed io_uring map.");
+  ur.cqMap = ur.sqMap;
+  if(0 < ur.cqSize){
+    ur.cqMap = mmap(NULL, ur.cqSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ur.fd, IORING_OFF_CQ_RING);
+    assert(MAP_FAILED != ur.cqMap && "Failed io_uring map.");
+  }
+  ur.sqesSize = p.sq_entries*sizeof(struct io_uring_sqe);
+  ur.sqes = mmap(NULL, ur.sqesSize, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, ur.fd, IORING_OFF_SQES);
+  assert(MAP_FAILED != ur.sqes && "Failed io_uring map.");
+
+  char *sq = ur.sqMap;
+  char *cq = ur.cqMap;
+  ur.sqTail = (_Atomic unsigned int *)(sq + p.sq_off.tail);
+  ur.sqMask = (unsigned int *)(sq + p.sq_off.ring_mask);
+  ur.sqArray = (unsigned int *)(sq + p.sq_off.array);
+  ur.cqHead = (_Atomic unsigned int *)(cq + p.cq_off.head);
+  ur.cqTail = (_Atomic unsigned int *)(cq + p.cq_off.tail);
+  ur.cqMask = (unsigned int *)(cq + p.cq_off.ring_mask);
+  ur.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+  struct stat st;
+  off_t at = lseek(0, 0, SEEK_CUR);
+  if(0 == fstat(0, &st) && S_ISREG(st.st_mode) && 0 <= at){
+    uringIn = 1;
+    ur.inNext = at;
+    ur.inSize = st.st_size;
+    ur.cur = -1;
+    for(int s = 0; s < URDEPTH; s++){
+      ur.B[s] = malloc(URCHUNK);
+      assert(NULL != ur.B[s] && "Failed alloc.");
+      uringRead(s);
+    }
+  }
+
+  if(p.features & IORING_FEAT_RW_CUR_POS){ /* Writes at the file offset */
+    uringOut = 1;
+    for(int s = 0; s < 2; s++){
+      ur.O[s] = malloc(URCHUNK);
+      assert(NULL != ur.O[s] && "Failed alloc.");
+    }
+  }
+}
+
+static int
+uringFill(int **P
+          )
+{ /* Gives back the last buffer and points P at the next bytes of stdin */
+  /* Returns their number, 0 at the end. */
+  if(0 <= ur.cur){ /* Read further ahead into it */
+    uringRead(ur.cur);
+    ur.cur = (ur.cur + 1) % URDEPTH;
+  } else
+    ur.cur = 0;
+
+  int s = ur.cur;
+  if(0 == ur.len[s])
+    return 0;
+  while(ur.pend[s])
+    uringReap();
+  assert(0 <= ur.res[s] && "Failed io_uring read.");
+
+  while(ur.res[s] < ur.len[s]){ /* Short read, finish it here */
+    ssize_t r = pread(0, ur.B[s] + ur.res[s], ur.len[s] - ur.res[s],
+                      ur.off[s] + ur.res[s]);
+    assert(0 < r && "Failed read.");
+    ur.res[s] += r;
+  }
+  *P = (int *)ur.B[s];
+
+  return ur.len[s];
+}
+
+static void
+uringWait(void)
+{ /* Waits for the answer write in flight and finishes it */
+  if(0 == ur.oSent)
+    return;
+  while(ur.oPend)
+    uringReap();
+  assert(0 <= ur.oRes && "Failed io_uring write.");
+
+  char *b = ur.O[1 - ur.oCur];
+  while(ur.oRes < ur.oSent){ /* Short write, finish it here */
+    ssize_t r = write(1, b + ur.oRes, ur.oSent - ur.oRes);
+    assert(0 < r && "Failed write.");
+    ur.oRes += r;
+  }
+  ur.oSent = 0;
+}
+
+static void
+uringFlush(void)
+{ /* Writes the current answer buffer and switches to the other one */
+  uringWait();
+  if(0 == ur.oLen)
+    return;
+  ur.oPend = 1;
+  ur.oSent = ur.oLen;
+  uringSubmit(IORING_OP_WRITE, 1, ur.O[ur.oCur], ur.oLen, -1, UROUT);
+  ur.oCur = 1 - ur.oCur;
+  ur.oLen = 0;
+}
+
+static int
+uringInt(char *b,
+         int x
+         )
+{ /* Writes x in decimal to b and returns its length */
+  char d[12];
+  int n = 0;
+  int l = 0;
+  unsigned int u = x;
+
+  if(0 > x){
+    b[l++] = '-';
+    u = -u;
+  }
+  do {
+    d[n++] = '0' + u % 10;
+    u /= 10;
+  } while(0 < u);
+  while(0 < n)
+    b[l++] = d[--n];
+
+  return l;
+}
+
+static void
+uringAnswer(int i,
+            int pos,
+            int v
+            )
+{ /* The line "i pos v" */
+  if(URCHUNK - 40 < ur.oLen)
+    uringFlush();
+
+  char *b = ur.O[ur.oCur] + ur.oLen;
+  int l = uringInt(b, i);
+  b[l++] = ' ';
+  l += uringInt(b + l, pos);
+  b[l++] = ' ';
+  l += uringInt(b + l, v);
+  b[l++] = '\n';
+  ur.oLen += l;
+}
+
+static void
+uringClose(void)
+{
+  if(0 > ur.fd)
+    return;
+
+  if(uringOut){
+    uringFlush();
+    uringWait();
+    free(ur.O[0]);
+    free(ur.O[1]);
+  }
+  if(uringIn)
+    for(int s = 0; s < URDEPTH; s++){
+      while(ur.pend[s]) /* The kernel still writes into it */
+        uringReap();
+      free(ur.B[s]);
+    }
+
+  munmap(ur.sqes, ur.sqesSize);
+  if(ur.cqMap != ur.sqMap)
+    munmap(ur.cqMap, ur.cqSize);
+  munmap(ur.sqMap, ur.sqSize);
+  close(ur.fd);
+  uringIn = 0;
+  uringOut = 0;
+}
+
+#endif /* URING_H */